@@ -0,0 +1,88 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+static size_t arena_round(size_t n, size_t to)
+{
+	return (n + to - 1) & ~(to - 1);
+}
+
+static size_t arena_header(void)
+{
+	return arena_round(sizeof(struct arena_chunk), ARENA_ALIGN);
+}
+
+/* Maps size bytes, on a huge page boundary when it is large enough for
+ * transparent huge pages to back it, and fresh from the kernel, zero.
+ */
+static void* arena_map(size_t size)
+{
+	if (size < ARENA_HUGE_PAGE) {
+		void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return p == MAP_FAILED ? NULL : p;
+	}
+	/* map more and cut off the ends to get the alignment */
+	size_t len = size + ARENA_HUGE_PAGE;
+	char *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return NULL;
+	char *start = (char *) arena_round((uintptr_t) p, ARENA_HUGE_PAGE);
+	if (start > p)
+		munmap(p, start - p);
+	if (p + len > start + size)
+		munmap(start + size, p + len - (start + size));
+#ifdef MADV_HUGEPAGE
+	/* only advice, e.g. when THP is off */
+	madvise(start, size, MADV_HUGEPAGE);
+#endif
+	return start;
+}
+
+void arena_init(Arena *a, size_t chunk_size)
+{
+	*a = (Arena) { .chunk_size = chunk_size };
+}
+
+/* size bytes of zeroes, aligned to a cache line */
+void* arena_alloc(Arena *a, size_t size)
+{
+	assert(a);
+	size = arena_round(size ? size : 1, ARENA_ALIGN);
+	struct arena_chunk *c = a->chunks;
+	/* what is left of the head chunk is given up when too small */
+	if (!c || c->size - c->used < size) {
+		size_t len = arena_header() + size;
+		if (len < a->chunk_size)
+			len = a->chunk_size;
+		len = arena_round(len, len < ARENA_HUGE_PAGE ?
+				  (size_t) sysconf(_SC_PAGESIZE) : ARENA_HUGE_PAGE);
+		c = arena_map(len);
+		if (!c) return NULL;
+		c->size = len;
+		c->used = arena_header();
+		c->next = a->chunks;
+		a->chunks = c;
+		a->mapped += len;
+		a->nr_chunks++;
+	}
+	void *p = (char *) c + c->used;
+	c->used += size;
+	return p;
+}
+
+void arena_release(Arena *a)
+{
+	struct arena_chunk *c = a->chunks;
+	while (c) {
+		struct arena_chunk *f = c;
+		c = c->next;
+		munmap(f, f->size);
+	}
+	arena_init(a, a->chunk_size);
+}
@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* mappings this large are aligned to, and advised as, huge pages */
+#define ARENA_HUGE_PAGE (2UL << 20)
+/* every allocation starts on a cache line */
+#define ARENA_ALIGN     64UL
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	/* bytes mapped, this header included */
+	size_t size;
+	size_t used;
+};
+
+/* Memory taken straight from the kernel in chunks, for the buffers
+ * sized by the scenario: node state, adjacency and event slabs. Pages
+ * are only made resident as they are touched. Nothing is freed on its
+ * own, arena_release() gives all the chunks back at once.
+ */
+struct arena {
+	/* newest first, allocations are taken from the head */
+	struct arena_chunk *chunks;
+	/* least size of a new chunk */
+	size_t chunk_size;
+	/* bytes mapped over all chunks */
+	size_t mapped;
+	size_t nr_chunks;
+};
+
+typedef struct arena Arena;
+
+void arena_init(Arena *a, size_t chunk_size);
+void* arena_alloc(Arena *a, size_t size);
+void arena_release(Arena *a);
+
+#endif
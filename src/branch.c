@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "branch.h"
+#include "config.h"
+#include "curve.h"
+#include "graph.h"
+#include "prioq.h"
+#include "sim.h"
+#include "stats.h"
+#include "log.h"
+
+/* Everything but prob_t, which takes effect at the branch. prob_y is
+ * only drawn on when the seeds are queued, before the branch.
+ */
+static bool branch_same_prefix(const Config *a, const Config *b)
+{
+	return a->sample_size == b->sample_size && a->nr_edges == b->nr_edges &&
+		a->prob_y == b->prob_y &&
+		a->model == b->model && a->rewire == b->rewire &&
+		a->time_max == b->time_max && a->seed == b->seed && a->rng == b->rng &&
+		a->replicates == b->replicates;
+}
+
+bool branch_check(const Config *variants, size_t nr, size_t day)
+{
+	if (day >= variants->time_max) {
+		log_error("Branch day must be before time_max.");
+		return false;
+	}
+	for (size_t i = 0; i < nr; i++) {
+		if (variants[i].replicates > 1) {
+			log_error("Branched scenarios run without replicates.");
+			return false;
+		}
+		if (!branch_same_prefix(variants, variants + i)) {
+			log_error("Scenario %zu differs from the first in more than prob_t.",
+				  i + 1);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* in the child: the rest of the run, with the prob_t of v */
+static void branch_follow(Sim *s, const Config *v, struct sir_count *curve,
+			  struct sim_stats *stats)
+{
+	NodeStore *ns = &s->nodes;
+
+	s->cfg.prob_t = v->prob_t;
+	/* every queued event is some node's pending one; a RECOVER has
+	   made its draw already */
+	for (size_t i = 0; i < 2 * ns->nr; i++) {
+		PQEvent *ev = ns->pending[i];
+		if (ev && ev->type == TRANSMIT)
+			ev->T = v->prob_t;
+	}
+	s->stats = (struct sim_stats) {};
+	s->halt_day = SIZE_MAX;
+	s->halt = NULL;
+	sim_simulate(s);
+	memcpy(curve, s->curve, s->cfg.time_max * sizeof *curve);
+	*stats = s->stats;
+}
+
+/* s is seeded, with the first of the variants */
+bool branch_run(Sim *s, const Config *variants, size_t nr, size_t day,
+		unsigned int nr_procs, CurveWriter *w)
+{
+	size_t days = s->cfg.time_max, next = 0, live = 0;
+	size_t size = nr * (days * sizeof(struct sir_count) + sizeof(struct sim_stats));
+	bool ret = true;
+
+	if (day) {
+		s->halt_day = day;
+		sim_simulate(s);
+		log_info("Branching %zu scenarios at day %zu.", nr, s->day);
+	}
+	/* the children's results, zero filled */
+	struct sir_count *curves = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (curves == MAP_FAILED) {
+		log_error("Failed to map memory for %zu branches: %s", nr, strerror(errno));
+		return false;
+	}
+	struct sim_stats *stats = (struct sim_stats *) (curves + nr * days);
+	/* or the children write out what is buffered once more */
+	log_sync();
+	fflush(stderr);
+	fflush(w->f);
+	while (next < nr || live) {
+		if (ret && next < nr && live < nr_procs) {
+			pid_t pid = fork();
+			if (pid < 0) {
+				log_error("Failed to start branch %zu: %s", next + 1, strerror(errno));
+				ret = false;
+				continue;
+			}
+			if (!pid) {
+				/* the log thread is left in the parent */
+				log_async_on = false;
+				branch_follow(s, variants + next, curves + next * days, stats + next);
+				fflush(stderr);
+				_exit(0);
+			}
+			next++;
+			live++;
+			continue;
+		}
+		int status;
+		if (wait(&status) < 0)
+			break;
+		live--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			log_error("A branch failed.");
+			ret = false;
+		}
+	}
+	for (size_t i = 0; ret && i < nr; i++) {
+		curve_begin(w, i);
+		for (size_t d = 0; d < days; d++)
+			curve_write(w, s->rng.key[1], d, curves + i * days + d);
+		stats_merge(&s->stats, stats + i);
+	}
+	munmap(curves, size);
+	return ret;
+}
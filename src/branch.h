@@ -0,0 +1,22 @@
+#ifndef BRANCH_H
+#define BRANCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "curve.h"
+#include "sim.h"
+
+/* Variants of one run that agree up to a day. The run goes that far
+ * once, then a child process per variant takes it on from there with
+ * the prob_t of the variant, starting from copy-on-write pages of the
+ * graph, the node states and the queue as the prefix left them. Only
+ * prob_t may differ between the variants: prob_y is drawn on only when
+ * the seeds are queued, so a change to it would be lost.
+ */
+bool branch_check(const Config *variants, size_t nr, size_t day);
+bool branch_run(Sim *s, const Config *variants, size_t nr, size_t day,
+		unsigned int nr_procs, CurveWriter *w);
+
+#endif
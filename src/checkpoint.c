@@ -0,0 +1,251 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "config.h"
+#include "graph.h"
+#include "prioq.h"
+#include "sim.h"
+#include "stats.h"
+#include "log.h"
+
+static uint64_t checkpoint_align(uint64_t pos)
+{
+	return (pos + 63) & ~(uint64_t) 63;
+}
+
+/* pads from *at up to pos, then writes n bytes there */
+static bool write_at(int fd, uint64_t *at, uint64_t pos, const void *p, size_t n)
+{
+	static const char zero[64];
+	assert(pos - *at <= sizeof zero);
+	const void *part[2] = { zero, p };
+	size_t len[2] = { pos - *at, n };
+	for (int i = 0; i < 2; i++) {
+		const char *c = part[i];
+		while (len[i]) {
+			ssize_t r = write(fd, c, len[i]);
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			c += r;
+			len[i] -= r;
+		}
+	}
+	*at = pos + n;
+	return true;
+}
+
+/* Saves s as it stands between two calls of sim_simulate(). The queue
+ * is emptied to list it in order and refilled the same way, which
+ * keeps the order of events on the same day.
+ */
+bool checkpoint_write(Sim *s, const char *path)
+{
+	PriorityQueue *pq = s->pq;
+	const Config *c = &s->cfg;
+	size_t n = c->sample_size, nr = pq->length, words = NODE_WORDS(n);
+	struct checkpoint_header h = {
+		.magic = CHECKPOINT_MAGIC,
+		.version = CHECKPOINT_VERSION,
+		.stats_size = sizeof s->stats,
+		.sample_size = n,
+		.nr_edges = c->nr_edges,
+		.time_max = c->time_max,
+		.seed = c->seed,
+		.prob_t = c->prob_t,
+		.prob_y = c->prob_y,
+		.rewire = c->rewire,
+		.model = c->model,
+		.rng = c->rng,
+		.replicate = s->rng.key[1],
+		.graph_edges = s->g->nr_edges,
+		.day = s->day,
+		.new_inf = s->new_inf,
+		.nr_events = nr,
+	};
+	char tmp[PATH_MAX];
+	uint64_t at = 0;
+	bool ret = true;
+	int fd;
+
+	h.state_pos = checkpoint_align(sizeof h);
+	h.initial_pos = checkpoint_align(h.state_pos + n);
+	h.curve_pos = checkpoint_align(h.initial_pos + words * sizeof(uint64_t));
+	h.events_pos = checkpoint_align(h.curve_pos + s->day * sizeof *s->curve);
+	h.stats_pos = checkpoint_align(h.events_pos + nr * sizeof(struct checkpoint_event));
+	if (snprintf(tmp, sizeof tmp, "%s.tmp", path) >= (int) sizeof tmp) {
+		log_error("Checkpoint path %s is too long.", path);
+		return false;
+	}
+	PQEvent **evs = malloc(nr * sizeof *evs);
+	struct checkpoint_event *rec = malloc(nr * sizeof *rec);
+	if ((nr && !evs) || (nr && !rec)) {
+		free(evs);
+		free(rec);
+		log_oom();
+		return false;
+	}
+	for (size_t i = 0; i < nr; i++) {
+		PQEvent *ev = evs[i] = pqevent_next(pq);
+		rec[i] = (struct checkpoint_event) {
+			.timestamp = ev->timestamp,
+			.node = ev->node,
+			.cause = ev->cause,
+			.type = ev->type,
+		};
+	}
+	for (size_t i = 0; i < nr; i++) {
+		if (!pqevent_add(pq, evs[i])) {
+			/* the run cannot go on without them */
+			log_error("Failed to queue events again after a checkpoint.");
+			ret = false;
+			break;
+		}
+	}
+	free(evs);
+	if (!ret) {
+		free(rec);
+		return false;
+	}
+
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("Failed to create checkpoint %s: %s", tmp, strerror(errno));
+		free(rec);
+		return false;
+	}
+	if (!write_at(fd, &at, 0, &h, sizeof h) ||
+	    !write_at(fd, &at, h.state_pos, s->nodes.state, n) ||
+	    !write_at(fd, &at, h.initial_pos, s->nodes.initial, words * sizeof(uint64_t)) ||
+	    !write_at(fd, &at, h.curve_pos, s->curve, s->day * sizeof *s->curve) ||
+	    !write_at(fd, &at, h.events_pos, rec, nr * sizeof *rec) ||
+	    !write_at(fd, &at, h.stats_pos, &s->stats, sizeof s->stats) ||
+	    fsync(fd) < 0 || close(fd) < 0) {
+		log_error("Failed to write checkpoint %s: %s", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		free(rec);
+		return false;
+	}
+	free(rec);
+	if (rename(tmp, path) < 0) {
+		log_error("Failed to rename checkpoint %s: %s", tmp, strerror(errno));
+		unlink(tmp);
+		return false;
+	}
+	return true;
+}
+
+static bool checkpoint_matches(const struct checkpoint_header *h, const Sim *s)
+{
+	const Config *c = &s->cfg;
+	return h->sample_size == c->sample_size && h->nr_edges == c->nr_edges &&
+		h->time_max == c->time_max && h->seed == c->seed &&
+		h->prob_t == c->prob_t && h->prob_y == c->prob_y &&
+		h->rewire == c->rewire && h->model == c->model && h->rng == c->rng &&
+		h->replicate == s->rng.key[1] && h->graph_edges == s->g->nr_edges &&
+		c->sample_size == s->g->nr_nodes;
+}
+
+/* In place of sim_seed(): s reset and on its graph, the run picks up
+ * where the checkpoint at path left it.
+ */
+bool checkpoint_restore(Sim *s, const char *path)
+{
+	const struct checkpoint_header *h;
+	NodeStore *ns = &s->nodes;
+	size_t n = s->cfg.sample_size, words = NODE_WORDS(n);
+	struct stat st;
+	bool ret = false;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log_error("Failed to open checkpoint %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	if ((size_t) st.st_size < sizeof *h) {
+		log_error("Checkpoint %s is too short.", path);
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_error("Failed to map checkpoint %s: %s", path, strerror(errno));
+		return false;
+	}
+	h = map;
+	if (memcmp(h->magic, CHECKPOINT_MAGIC, sizeof h->magic) || h->version != CHECKPOINT_VERSION ||
+	    h->stats_size != sizeof s->stats)
+		goto bad;
+	if (!checkpoint_matches(h, s)) {
+		log_error("Checkpoint %s is of another scenario or graph.", path);
+		goto out;
+	}
+	if (h->day > s->cfg.time_max || h->nr_events > (uint64_t) st.st_size ||
+	    h->state_pos + n > (uint64_t) st.st_size ||
+	    h->initial_pos % sizeof(uint64_t) ||
+	    h->initial_pos + words * sizeof(uint64_t) > (uint64_t) st.st_size ||
+	    h->curve_pos % sizeof(size_t) ||
+	    h->curve_pos + h->day * sizeof *s->curve > (uint64_t) st.st_size ||
+	    h->events_pos % sizeof(uint64_t) ||
+	    h->events_pos + h->nr_events * sizeof(struct checkpoint_event) > (uint64_t) st.st_size ||
+	    h->stats_pos % sizeof(uint64_t) ||
+	    h->stats_pos + sizeof s->stats > (uint64_t) st.st_size)
+		goto bad;
+
+	const char *base = map;
+	const uint8_t *state = (const uint8_t *) (base + h->state_pos);
+	for (size_t i = 0; i < n; i++) {
+		if (state[i] < SIR_SUSCEPTIBLE || state[i] >= _SIR_TYPE_MAX)
+			goto bad;
+		if (state[i] != SIR_SUSCEPTIBLE)
+			node_move(ns, i, state[i]);
+	}
+	memcpy(ns->initial, base + h->initial_pos, words * sizeof(uint64_t));
+	memcpy(s->curve, base + h->curve_pos, h->day * sizeof *s->curve);
+	const struct checkpoint_event *rec = (const struct checkpoint_event *) (base + h->events_pos);
+	for (size_t i = 0; i < h->nr_events; i++) {
+		if (rec[i].node >= n || (rec[i].type != TRANSMIT && rec[i].type != RECOVER) ||
+		    *node_pending(ns, rec[i].node, rec[i].type))
+			goto bad;
+		PQEvent *ev = pqevent_new(s->pq, rec[i].node, rec[i].type);
+		if (!ev) {
+			log_oom();
+			goto out;
+		}
+		ev->timestamp = rec[i].timestamp;
+		ev->cause = rec[i].cause;
+		if (!pqevent_add(s->pq, ev)) {
+			pqevent_delete(s->pq, ev);
+			log_oom();
+			goto out;
+		}
+		*node_pending(ns, rec[i].node, rec[i].type) = ev;
+	}
+	s->day = h->day;
+	s->new_inf = h->new_inf;
+	stats_merge(&s->stats, (const struct sim_stats *) (base + h->stats_pos));
+	ret = true;
+	goto out;
+bad:
+	log_error("%s is not a usable version %u checkpoint.", path, CHECKPOINT_VERSION);
+out:
+	munmap(map, st.st_size);
+	return ret;
+}
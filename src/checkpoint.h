@@ -0,0 +1,64 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim.h"
+#include "stats.h"
+
+/* A checkpoint is a run stopped at the start of a day: the scenario it
+ * belongs to, the node states, the curve so far and the queued events
+ * in the order they come out. Like a snapshot, everything is at a
+ * position from the start of the file and nodes are indices, so it is
+ * mapped and read in place. Random numbers need no saving, every draw
+ * is keyed by the scenario and the node.
+ */
+#define CHECKPOINT_MAGIC   "SIRCKPT"
+#define CHECKPOINT_VERSION 1U
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t stats_size;
+	/* the scenario, as it must be on restore */
+	uint64_t sample_size;
+	uint64_t nr_edges;
+	uint64_t time_max;
+	uint64_t seed;
+	double prob_t;
+	double prob_y;
+	double rewire;
+	uint32_t model;
+	uint32_t rng;
+	uint64_t replicate;
+	/* of the graph the run was on */
+	uint64_t graph_edges;
+	/* first day not recorded, and infections on it so far */
+	uint64_t day;
+	uint64_t new_inf;
+	uint64_t nr_events;
+	/* sample_size bytes of node state */
+	uint64_t state_pos;
+	/* NODE_WORDS(sample_size) words, the initial spreaders */
+	uint64_t initial_pos;
+	/* day entries of struct sir_count */
+	uint64_t curve_pos;
+	/* nr_events entries of struct checkpoint_event */
+	uint64_t events_pos;
+	/* struct sim_stats of the run so far */
+	uint64_t stats_pos;
+};
+
+struct checkpoint_event {
+	uint64_t timestamp;
+	uint32_t node;
+	uint32_t cause;
+	uint32_t type;
+	uint32_t pad;
+};
+
+bool checkpoint_write(Sim *s, const char *path);
+bool checkpoint_restore(Sim *s, const char *path);
+
+#endif
@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+#include "prioq.h"
+
+void config_default(Config *c)
+{
+	assert(c);
+	c->sample_size = SAMPLE_SIZE;
+	c->nr_edges = NR_EDGES;
+	c->model = MODEL;
+	c->rewire = REWIRE;
+	c->time_max = TIME_MAX;
+	c->prob_t = PROB_T;
+	c->prob_y = PROB_Y;
+	c->seed = SEED;
+	c->rng = RNG_KIND;
+	c->replicates = REPLICATES;
+}
+
+/* a whole number, all of s and without a sign */
+bool config_parse_ulong(const char *s, unsigned long *r)
+{
+	char *end;
+	errno = 0;
+	*r = strtoul(s, &end, 0);
+	return !errno && end != s && !*end && *s != '-';
+}
+
+static bool parse_double(const char *s, double *r)
+{
+	char *end;
+	errno = 0;
+	*r = strtod(s, &end);
+	return !errno && end != s && !*end;
+}
+
+bool config_set(Config *c, const char *key, const char *value)
+{
+	assert(c);
+	assert(key && value);
+	unsigned long u;
+	double d;
+	if (!strcmp(key, "sample_size") && config_parse_ulong(value, &u))
+		c->sample_size = u;
+	else if (!strcmp(key, "nr_edges") && config_parse_ulong(value, &u))
+		c->nr_edges = u;
+	else if (!strcmp(key, "model") && graph_model_parse(value, &c->model))
+		;
+	else if (!strcmp(key, "rewire") && parse_double(value, &d))
+		c->rewire = d;
+	else if (!strcmp(key, "time_max") && config_parse_ulong(value, &u))
+		c->time_max = u;
+	else if (!strcmp(key, "prob_t") && parse_double(value, &d))
+		c->prob_t = d;
+	else if (!strcmp(key, "prob_y") && parse_double(value, &d))
+		c->prob_y = d;
+	else if (!strcmp(key, "seed") && config_parse_ulong(value, &u))
+		c->seed = u;
+	else if (!strcmp(key, "rng") && rng_kind_parse(value, &c->rng))
+		;
+	else if (!strcmp(key, "replicates") && config_parse_ulong(value, &u))
+		c->replicates = u;
+	else {
+		log_error("Invalid scenario setting %s=%s", key, value);
+		return false;
+	}
+	return true;
+}
+
+/* str holds key=value pairs separated by commas or blanks, and is
+   modified in place */
+bool config_parse(Config *c, char *str)
+{
+	char *save, *tok;
+	for (tok = strtok_r(str, ", \t\n", &save); tok; tok = strtok_r(NULL, ", \t\n", &save)) {
+		char *eq = strchr(tok, '=');
+		if (!eq) {
+			log_error("Expected key=value in scenario, got %s", tok);
+			return false;
+		}
+		*eq = '\0';
+		if (!config_set(c, tok, eq + 1))
+			return false;
+	}
+	return true;
+}
+
+bool config_check(const Config *c)
+{
+	/* node ids are 1-based unsigned ints */
+	if (!c->sample_size || c->sample_size >= UINT_MAX) {
+		log_error("sample_size must be between 1 and %u.", UINT_MAX - 1);
+		return false;
+	}
+	if (c->nr_edges > c->sample_size - 1) {
+		log_error("Incorrect nr_edges value configured.");
+		return false;
+	}
+	if ((c->model == GRAPH_BA || c->model == GRAPH_WS) && c->nr_edges < 2) {
+		log_error("nr_edges must be at least 2 for model=%s.", graph_model_name(c->model));
+		return false;
+	}
+	if (!(c->rewire >= 0.0 && c->rewire <= 1.0)) {
+		log_error("rewire must be in [0, 1].");
+		return false;
+	}
+	if (!c->replicates) {
+		log_error("replicates must be at least 1.");
+		return false;
+	}
+	if (c->time_max <= DETECT_DAYS) {
+		log_error("time_max must be larger than %u.", DETECT_DAYS);
+		return false;
+	}
+	/* the heap keys hold no later day */
+	if (c->time_max >= PQ_TS_MAX) {
+		log_error("time_max must be smaller than %" PRIu64 ".", PQ_TS_MAX);
+		return false;
+	}
+	if (!(c->prob_t > 0.0 && c->prob_t <= 1.0) || !(c->prob_y > 0.0 && c->prob_y <= 1.0)) {
+		log_error("Probabilities must be in (0, 1].");
+		return false;
+	}
+	return true;
+}
+
+void config_dump(const Config *c)
+{
+	log_info("sample_size=%zu nr_edges=%zu model=%s time_max=%lu prob_t=%g prob_y=%g seed=%#" PRIx64 " rng=%s replicates=%zu",
+		 c->sample_size, c->nr_edges, graph_model_name(c->model), c->time_max, c->prob_t, c->prob_y, c->seed,
+		 rng_kind_name(c->rng), c->replicates);
+}
+
+static const char *model_name[_GRAPH_MODEL_MAX] = {
+	[GRAPH_RANDOM] = "random",
+	[GRAPH_GNM] = "gnm",
+	[GRAPH_BA] = "ba",
+	[GRAPH_WS] = "ws",
+};
+
+bool graph_model_parse(const char *name, GraphModel *m)
+{
+	for (int i = 0; i < _GRAPH_MODEL_MAX; i++) {
+		if (!strcmp(name, model_name[i])) {
+			*m = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* graph_model_name(GraphModel m)
+{
+	assert(m < _GRAPH_MODEL_MAX);
+	return model_name[m];
+}
@@ -1,4 +1,73 @@
-// Test case for simulation
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+// Test case for simulation, used unless a scenario says otherwise
 #define SAMPLE_SIZE 10000U
 #define NR_EDGES    100U
 #define TIME_MAX    100U
+#define PROB_T      0.5
+#define PROB_Y      0.2
+#define SEED        0x0bad1dea
+#define REPLICATES  1U
+// Counter-based generator, RNG_PHILOX or RNG_THREEFRY
+#define RNG_KIND    RNG_PHILOX
+#define MODEL       GRAPH_RANDOM
+#define REWIRE      0.1
+// Event queue backend, PQ_HEAP or PQ_CALENDAR; both give the same curves
+#define PQ_BACKEND  PQ_CALENDAR
+
+/* recovery is only possible after being detected as infected */
+#define DETECT_DAYS 12U
+
+/* how the contact graph is generated */
+enum graph_model {
+	/* every other node draws up to nr_edges neighbours */
+	GRAPH_RANDOM,
+	/* Erdos-Renyi G(n, m), n * nr_edges / 2 edges */
+	GRAPH_GNM,
+	/* Barabasi-Albert, each node attaches to nr_edges / 2 others */
+	GRAPH_BA,
+	/* Watts-Strogatz, a ring of degree nr_edges, rewired */
+	GRAPH_WS,
+	_GRAPH_MODEL_MAX,
+};
+
+typedef enum graph_model GraphModel;
+
+/* Parameters of one simulation run. */
+struct config {
+	size_t sample_size;
+	/* for GRAPH_RANDOM the most edges a node draws, for the other
+	   models the mean degree */
+	size_t nr_edges;
+	GraphModel model;
+	/* chance of rewiring an edge of GRAPH_WS */
+	double rewire;
+	unsigned long time_max;
+	/* per day probabilities of transmission and recovery */
+	double prob_t;
+	double prob_y;
+	uint64_t seed;
+	RngKind rng;
+	/* independent runs on the same graph */
+	size_t replicates;
+};
+
+typedef struct config Config;
+
+void config_default(Config *c);
+bool config_parse_ulong(const char *s, unsigned long *r);
+bool config_set(Config *c, const char *key, const char *value);
+bool config_parse(Config *c, char *str);
+bool config_check(const Config *c);
+void config_dump(const Config *c);
+bool graph_model_parse(const char *name, GraphModel *m);
+const char* graph_model_name(GraphModel m);
+
+#endif
@@ -0,0 +1,78 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "curve.h"
+#include "log.h"
+
+/* path - is stdout */
+bool curve_writer_open(CurveWriter *w, const char *path, CurveFormat fmt)
+{
+	*w = (CurveWriter) { .fmt = fmt };
+	w->f = strcmp(path, "-") ? fopen(path, fmt == CURVE_BINARY ? "wb" : "w") : stdout;
+	if (!w->f) {
+		log_error("Failed to open curve output %s: %s", path, strerror(errno));
+		return false;
+	}
+	if (fmt == CURVE_BINARY) {
+		struct curve_header h = {
+			.magic = CURVE_MAGIC,
+			.version = CURVE_VERSION,
+			.record_size = sizeof(struct curve_record),
+		};
+		fwrite(&h, sizeof h, 1, w->f);
+	}
+	return true;
+}
+
+bool curve_writer_close(CurveWriter *w)
+{
+	bool ret = true;
+	if (!w->f) return true;
+	if (ferror(w->f) | (w->f == stdout ? fflush(w->f) : fclose(w->f))) {
+		log_error("Failed to write curve output.");
+		ret = false;
+	}
+	*w = (CurveWriter) {};
+	return ret;
+}
+
+void curve_begin(CurveWriter *w, size_t scenario)
+{
+	w->scenario = scenario;
+}
+
+/* true when the header of cols is due, the caller writes it */
+bool curve_columns(CurveWriter *w, enum curve_columns cols)
+{
+	if (w->cols == cols)
+		return false;
+	w->cols = cols;
+	return true;
+}
+
+/* errors are sticky in the stream, and reported on close */
+void curve_write(CurveWriter *w, size_t replicate, size_t day, const struct sir_count *c)
+{
+	assert(w->f);
+	if (w->fmt == CURVE_BINARY) {
+		struct curve_record rec = {
+			.scenario = w->scenario,
+			.replicate = replicate,
+			.day = day,
+			.s = c->s,
+			.i = c->i,
+			.r = c->r,
+			.new_inf = c->new_inf,
+		};
+		fwrite(&rec, sizeof rec, 1, w->f);
+		return;
+	}
+	if (curve_columns(w, CURVE_COLS_RUN))
+		fprintf(w->f, "scenario,replicate,day,S,I,R,new\n");
+	fprintf(w->f, "%u,%zu,%zu,%zu,%zu,%zu,%zu\n", w->scenario, replicate, day,
+		c->s, c->i, c->r, c->new_inf);
+}
@@ -0,0 +1,79 @@
+#ifndef CURVE_H
+#define CURVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* compartment sizes at the end of a day */
+struct sir_count {
+	size_t s;
+	size_t i;
+	size_t r;
+	/* moved from S to I during the day */
+	size_t new_inf;
+};
+
+enum curve_format {
+	CURVE_CSV,
+	CURVE_BINARY,
+};
+
+typedef enum curve_format CurveFormat;
+
+/* The binary format is a header followed by fixed size records in host
+ * byte order, one per day of each run, in the order the days end.
+ */
+#define CURVE_MAGIC   "SIRC"
+#define CURVE_VERSION 1U
+
+struct curve_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t reserved;
+};
+
+struct curve_record {
+	uint32_t scenario;
+	uint32_t replicate;
+	uint32_t day;
+	uint32_t reserved;
+	uint64_t s;
+	uint64_t i;
+	uint64_t r;
+	uint64_t new_inf;
+};
+
+_Static_assert(sizeof(struct curve_record) == 48, "curve record has padding");
+
+/* columns of a CSV curve, a header line goes before the first row
+   and wherever they change */
+enum curve_columns {
+	CURVE_COLS_NONE,
+	/* scenario,replicate,day,S,I,R,new */
+	CURVE_COLS_RUN,
+	/* scenario,day and the statistics of ensemble_dump() */
+	CURVE_COLS_STATS,
+};
+
+/* Streams the epidemic curve of each run as its days end. */
+struct curve_writer {
+	FILE *f;
+	CurveFormat fmt;
+	/* index of the scenario being run */
+	uint32_t scenario;
+	/* of the last header written */
+	enum curve_columns cols;
+};
+
+typedef struct curve_writer CurveWriter;
+
+bool curve_writer_open(CurveWriter *w, const char *path, CurveFormat fmt);
+bool curve_writer_close(CurveWriter *w);
+void curve_begin(CurveWriter *w, size_t scenario);
+bool curve_columns(CurveWriter *w, enum curve_columns cols);
+void curve_write(CurveWriter *w, size_t replicate, size_t day, const struct sir_count *c);
+
+#endif
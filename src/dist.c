@@ -0,0 +1,100 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "dist.h"
+#include "rng.h"
+#include "log.h"
+
+/* Number of trials up to and including the first success, when each
+ * succeeds with probability p, or max if that is smaller. Inverse
+ * transform: P(X > k) = (1 - p)^k, so X = 1 + floor(log(U) / log(1 - p))
+ * for U uniform in (0, 1].
+ */
+size_t dist_geometric(RngStream *st, double p, size_t max)
+{
+	assert(p > 0.0 && p <= 1.0);
+	assert(max);
+	if (p == 1.0)
+		return 1;
+	double u = 1.0 - rng_uniform(st);
+	double x = floor(log(u) / log1p(-p));
+	/* compare as double, x may not fit in a size_t */
+	return x < (double) (max - 1) ? (size_t) x + 1 : max;
+}
+
+bool alias_table_init(AliasTable *a, const double *w, size_t n)
+{
+	assert(a);
+	assert(n && n <= UINT32_MAX);
+	double sum = 0.0;
+	size_t *work = NULL;
+
+	*a = (AliasTable) { .n = n };
+	for (size_t i = 0; i < n; i++) {
+		if (!(w[i] >= 0.0)) {
+			log_error("Weight %zu of alias table is negative.", i);
+			return false;
+		}
+		sum += w[i];
+	}
+	if (!(sum > 0.0)) {
+		log_error("Weights of alias table sum to zero.");
+		return false;
+	}
+
+	a->prob = malloc(n * sizeof *a->prob);
+	a->alias = malloc(n * sizeof *a->alias);
+	/* small columns fill from the front, large from the back */
+	work = malloc(n * sizeof *work);
+	if (!a->prob || !a->alias || !work) {
+		log_oom();
+		free(work);
+		alias_table_release(a);
+		return false;
+	}
+
+	size_t nr_small = 0, large = n;
+	for (size_t i = 0; i < n; i++) {
+		a->prob[i] = w[i] * n / sum;
+		a->alias[i] = i;
+		if (a->prob[i] < 1.0)
+			work[nr_small++] = i;
+		else
+			work[--large] = i;
+	}
+	/* top up each small column from a large one, which may turn
+	   small in turn */
+	size_t s = 0;
+	while (s < nr_small && large < n) {
+		size_t i = work[s++], j = work[large];
+		a->alias[i] = j;
+		a->prob[j] -= 1.0 - a->prob[i];
+		if (a->prob[j] < 1.0) {
+			large++;
+			work[nr_small++] = j;
+		}
+	}
+	/* whatever is left is 1 up to rounding */
+	for (; s < nr_small; s++)
+		a->prob[work[s]] = 1.0;
+	for (; large < n; large++)
+		a->prob[work[large]] = 1.0;
+	free(work);
+	return true;
+}
+
+void alias_table_release(AliasTable *a)
+{
+	free(a->prob);
+	free(a->alias);
+	*a = (AliasTable) {};
+}
+
+size_t alias_table_sample(const AliasTable *a, RngStream *st)
+{
+	size_t i = rng_bounded(st, a->n);
+	return rng_uniform(st) < a->prob[i] ? i : a->alias[i];
+}
@@ -0,0 +1,32 @@
+#ifndef DIST_H
+#define DIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+/* Samplers for delay distributions, each taking a constant number of
+ * draws from the stream.
+ */
+
+size_t dist_geometric(RngStream *st, double p, size_t max);
+
+/* Walker's alias method, as laid out by Vose: one bounded draw picks
+ * a column, one uniform draw picks between the column and its alias.
+ */
+struct alias_table {
+	size_t n;
+	/* probability of keeping column i */
+	double *prob;
+	uint32_t *alias;
+};
+
+typedef struct alias_table AliasTable;
+
+bool alias_table_init(AliasTable *a, const double *w, size_t n);
+void alias_table_release(AliasTable *a);
+size_t alias_table_sample(const AliasTable *a, RngStream *st);
+
+#endif
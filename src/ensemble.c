@@ -0,0 +1,209 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "curve.h"
+#include "ensemble.h"
+#include "sim.h"
+#include "stats.h"
+#include "log.h"
+
+bool ensemble_init(Ensemble *e, unsigned int nr_threads)
+{
+	assert(nr_threads);
+	*e = (Ensemble) { .nr_threads = nr_threads };
+	e->workers = calloc(nr_threads, sizeof *e->workers);
+	if (!e->workers) return false;
+	for (unsigned int i = 0; i < nr_threads; i++)
+		e->workers[i].e = e;
+	return true;
+}
+
+void ensemble_release(Ensemble *e)
+{
+	if (e->workers)
+		for (unsigned int i = 0; i < e->nr_threads; i++)
+			if (e->workers[i].ready)
+				sim_release(&e->workers[i].sim);
+	free(e->workers);
+	free(e->curves);
+	free(e->stats);
+	free(e->sorted);
+	*e = (Ensemble) {};
+}
+
+static void* ensemble_work(void *arg)
+{
+	struct ensemble_worker *w = arg;
+	Ensemble *e = w->e;
+	Sim *s = &w->sim;
+	size_t days = e->cfg->time_max;
+
+	if (!w->ready) {
+		if (!sim_init(s, e->cfg)) {
+			sim_release(s);
+			atomic_store(&e->failed, true);
+			return NULL;
+		}
+		w->ready = true;
+	}
+	for (;;) {
+		size_t r = atomic_fetch_add(&e->next, 1);
+		if (r >= e->cfg->replicates || atomic_load(&e->failed))
+			break;
+		if (!sim_reset(s, e->cfg)) {
+			atomic_store(&e->failed, true);
+			break;
+		}
+		sim_share_graph(s, e->g);
+		sim_set_replicate(s, r);
+		if (!sim_seed(s)) {
+			atomic_store(&e->failed, true);
+			break;
+		}
+		sim_simulate(s);
+		memcpy(e->curves + r * days, s->curve, days * sizeof *s->curve);
+	}
+	return NULL;
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* linear interpolation between the closest ranks */
+static double quantile(const size_t *v, size_t n, double q)
+{
+	double pos = q * (n - 1);
+	size_t lo = pos;
+	if (lo + 1 >= n) return v[n - 1];
+	return v[lo] + (pos - lo) * ((double) v[lo + 1] - v[lo]);
+}
+
+static size_t series(const struct sir_count *sc, int c)
+{
+	switch (c) {
+	case 0: return sc->s;
+	case 1: return sc->i;
+	case 2: return sc->r;
+	default: return sc->new_inf;
+	}
+}
+
+static void ensemble_merge(Ensemble *e)
+{
+	size_t days = e->cfg->time_max, n = e->cfg->replicates;
+	for (size_t d = 0; d < days; d++) {
+		for (int c = 0; c < ENSEMBLE_NR_SERIES; c++) {
+			struct ensemble_stat *st = &e->stats[d * ENSEMBLE_NR_SERIES + c];
+			double mean = 0.0, m2 = 0.0;
+			for (size_t r = 0; r < n; r++) {
+				struct sir_count *sc = &e->curves[r * days + d];
+				size_t x = series(sc, c);
+				/* Welford, to stay accurate for large counts */
+				double delta = x - mean;
+				mean += delta / (r + 1);
+				m2 += delta * (x - mean);
+				e->sorted[r] = x;
+			}
+			qsort(e->sorted, n, sizeof *e->sorted, cmp_size);
+			st->mean = mean;
+			st->var = n > 1 ? m2 / (n - 1) : 0.0;
+			st->q05 = quantile(e->sorted, n, 0.05);
+			st->q50 = quantile(e->sorted, n, 0.50);
+			st->q95 = quantile(e->sorted, n, 0.95);
+		}
+	}
+}
+
+static bool grow(void **p, size_t *cap, size_t n, size_t size)
+{
+	if (n <= *cap) return true;
+	void *b = reallocarray(*p, n, size);
+	if (!b) return false;
+	*p = b;
+	*cap = n;
+	return true;
+}
+
+bool ensemble_run(Ensemble *e, const Config *cfg, Graph *g)
+{
+	size_t days = cfg->time_max, n = cfg->replicates;
+	unsigned int nr = e->nr_threads < n ? e->nr_threads : n;
+
+	assert(n);
+	if (!grow((void **) &e->curves, &e->cap_curves, n * days, sizeof *e->curves) ||
+	    !grow((void **) &e->stats, &e->cap_stats, ENSEMBLE_NR_SERIES * days, sizeof *e->stats) ||
+	    !grow((void **) &e->sorted, &e->cap_sorted, n, sizeof *e->sorted)) {
+		log_error("Failed to allocate ensemble curves.");
+		log_oom();
+		return false;
+	}
+	e->cfg = cfg;
+	e->g = g;
+	atomic_store(&e->next, 0);
+	atomic_store(&e->failed, false);
+
+	unsigned int started = 0;
+	for (; started < nr; started++) {
+		if (pthread_create(&e->workers[started].tid, NULL, ensemble_work, &e->workers[started])) {
+			log_warn("Failed to start ensemble thread %u.", started);
+			break;
+		}
+	}
+	/* without any thread, do the work here */
+	if (!started)
+		ensemble_work(&e->workers[0]);
+	for (unsigned int i = 0; i < started; i++)
+		pthread_join(e->workers[i].tid, NULL);
+	if (atomic_load(&e->failed)) {
+		log_error("Ensemble run failed.");
+		return false;
+	}
+	ensemble_merge(e);
+	return true;
+}
+
+void ensemble_dump(const Ensemble *e, CurveWriter *w)
+{
+	static const char *name[ENSEMBLE_NR_SERIES] = { "S", "I", "R", "new" };
+	FILE *f = w->f;
+	if (curve_columns(w, CURVE_COLS_STATS)) {
+		fprintf(f, "scenario,day");
+		for (int c = 0; c < ENSEMBLE_NR_SERIES; c++)
+			fprintf(f, ",%s_mean,%s_var,%s_q05,%s_q50,%s_q95",
+				name[c], name[c], name[c], name[c], name[c]);
+		fprintf(f, "\n");
+	}
+	for (size_t d = 0; d < e->cfg->time_max; d++) {
+		fprintf(f, "%u,%zu", w->scenario, d);
+		for (int c = 0; c < ENSEMBLE_NR_SERIES; c++) {
+			const struct ensemble_stat *st = &e->stats[d * ENSEMBLE_NR_SERIES + c];
+			fprintf(f, ",%.3f,%.3f,%.1f,%.1f,%.1f", st->mean, st->var, st->q05, st->q50, st->q95);
+		}
+		fprintf(f, "\n");
+	}
+}
+
+/* the curve of every replicate, rather than their statistics */
+void ensemble_write(const Ensemble *e, CurveWriter *w)
+{
+	size_t days = e->cfg->time_max;
+	for (size_t r = 0; r < e->cfg->replicates; r++)
+		for (size_t d = 0; d < days; d++)
+			curve_write(w, r, d, e->curves + r * days + d);
+}
+
+/* add the counters of every worker to the stats report */
+void ensemble_collect_stats(const Ensemble *e)
+{
+	for (unsigned int i = 0; i < e->nr_threads; i++)
+		if (e->workers[i].ready)
+			stats_collect(&e->workers[i].sim.stats);
+}
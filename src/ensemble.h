@@ -0,0 +1,70 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "curve.h"
+#include "graph.h"
+#include "sim.h"
+
+/* S, I, R and new infections */
+#define ENSEMBLE_NR_SERIES 4
+
+/* one series on one day, over all replicates */
+struct ensemble_stat {
+	double mean;
+	double var;
+	/* 5th, 50th and 95th percentile */
+	double q05;
+	double q50;
+	double q95;
+};
+
+struct ensemble_worker {
+	struct ensemble *e;
+	pthread_t tid;
+	/* kept from one scenario to the next */
+	Sim sim;
+	bool ready;
+};
+
+/* Runs the replicates of a scenario on a fixed set of worker threads,
+ * each owning a simulation context. Replicates are handed out one at a
+ * time, and every replicate draws from the streams keyed by the
+ * scenario seed and its index, so the merged curves do not depend
+ * on the number of threads or on scheduling.
+ */
+struct ensemble {
+	struct ensemble_worker *workers;
+	unsigned int nr_threads;
+	/* current scenario */
+	const Config *cfg;
+	Graph *g;
+	atomic_size_t next;
+	atomic_bool failed;
+	/* curve of replicate r starts at curves + r * time_max */
+	struct sir_count *curves;
+	size_t cap_curves;
+	/* S, I, R and new infections for each day */
+	struct ensemble_stat *stats;
+	size_t cap_stats;
+	/* scratch for the quantiles, one entry per replicate */
+	size_t *sorted;
+	size_t cap_sorted;
+};
+
+typedef struct ensemble Ensemble;
+
+bool ensemble_init(Ensemble *e, unsigned int nr_threads);
+void ensemble_release(Ensemble *e);
+bool ensemble_run(Ensemble *e, const Config *cfg, Graph *g);
+void ensemble_dump(const Ensemble *e, CurveWriter *w);
+void ensemble_write(const Ensemble *e, CurveWriter *w);
+void ensemble_collect_stats(const Ensemble *e);
+
+#endif
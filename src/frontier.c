@@ -0,0 +1,397 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "frontier.h"
+#include "graph.h"
+#include "prioq.h"
+#include "rng.h"
+#include "sim.h"
+#include "stats.h"
+#include "log.h"
+
+/* nodes handed out at a time when applying a round */
+#define FRONTIER_CHUNK 256
+
+bool frontier_init(Frontier *f, unsigned int nr_threads)
+{
+	assert(nr_threads);
+	*f = (Frontier) { .nr_threads = nr_threads };
+	pthread_mutex_init(&f->gate, NULL);
+	f->workers = calloc(nr_threads, sizeof *f->workers);
+	if (!f->workers) return false;
+	for (unsigned int i = 0; i < nr_threads; i++) {
+		struct frontier_worker *w = &f->workers[i];
+		w->f = f;
+		w->index = i;
+	}
+	return true;
+}
+
+void frontier_release(Frontier *f)
+{
+	if (!f->nr_threads) return;
+	if (f->workers)
+		for (unsigned int i = 0; i < f->nr_threads; i++) {
+			struct frontier_worker *w = &f->workers[i];
+			for (size_t d = 0; d < w->nr_due; d++)
+				node_vec_release(&w->due[d]);
+			free(w->due);
+			node_vec_release(&w->infected);
+		}
+	free(f->workers);
+	node_vec_release(&f->cur);
+	free(f->pending);
+	free(f->visit);
+	free(f->before);
+	free(f->rank);
+	pthread_mutex_destroy(&f->gate);
+	*f = (Frontier) {};
+}
+
+/* enough state for a run of s, cleared */
+static bool frontier_reset(Frontier *f, Sim *s)
+{
+	size_t n = s->cfg.sample_size, days = s->cfg.time_max;
+
+	if (n > f->cap_nodes) {
+		void *p = reallocarray(f->pending, 2 * n, sizeof *f->pending);
+		if (!p) return false;
+		f->pending = p;
+		p = reallocarray(f->visit, n, sizeof *f->visit);
+		if (!p) return false;
+		f->visit = p;
+		p = reallocarray(f->before, n, sizeof *f->before);
+		if (!p) return false;
+		f->before = p;
+		p = reallocarray(f->rank, n, sizeof *f->rank);
+		if (!p) return false;
+		f->rank = p;
+		f->cap_nodes = n;
+	}
+	for (size_t i = 0; i < 2 * n; i++)
+		atomic_init(&f->pending[i], FRONTIER_NONE);
+	for (size_t i = 0; i < n; i++)
+		atomic_init(&f->visit[i], 0);
+	for (unsigned int i = 0; i < f->nr_threads; i++) {
+		struct frontier_worker *w = &f->workers[i];
+		if (days > w->nr_due) {
+			struct node_vec *due = reallocarray(w->due, days, sizeof *due);
+			if (!due) return false;
+			w->due = due;
+			for (; w->nr_due < days; w->nr_due++)
+				due[w->nr_due] = (struct node_vec) {};
+		}
+		for (size_t d = 0; d < w->nr_due; d++)
+			node_vec_clear(&w->due[d]);
+		node_vec_clear(&w->infected);
+		memset(w->delta, 0, sizeof w->delta);
+		w->new_inf = 0;
+		w->failed = false;
+		w->stats = (struct sim_stats) {};
+	}
+	f->s = s;
+	f->day = 0;
+	f->round = 0;
+	f->stop = false;
+	return true;
+}
+
+/* the events of the initial spreaders, moved over from the queue */
+static bool frontier_take_seed(Frontier *f)
+{
+	Sim *s = f->s;
+	struct frontier_worker *w = &f->workers[0];
+	PQEvent *ev;
+	bool ret = true;
+
+	while ((ev = pqevent_next(s->pq))) {
+		size_t n = ev->node;
+		*node_pending(&s->nodes, n, ev->type) = NULL;
+		atomic_store_explicit(&f->pending[2 * n + ev->type - 1],
+				      (uint64_t) ev->timestamp << 32, memory_order_relaxed);
+		if (ev->timestamp < s->cfg.time_max &&
+		    node_vec_push(&w->due[ev->timestamp], ev->node) < 0)
+			ret = false;
+		pqevent_delete(s->pq, ev);
+	}
+	return ret;
+}
+
+static void frontier_move(struct frontier_worker *w, unsigned int n, Status to)
+{
+	NodeStore *ns = &w->f->s->nodes;
+	Status from = ns->state[n];
+	uint64_t bit = UINT64_C(1) << (n % 64);
+
+	/* neighbouring nodes share the words */
+	__atomic_fetch_and(&ns->bits[from][n / 64], ~bit, __ATOMIC_RELAXED);
+	__atomic_fetch_or(&ns->bits[to][n / 64], bit, __ATOMIC_RELAXED);
+	w->delta[from]--;
+	w->delta[to]++;
+	ns->state[n] = to;
+}
+
+static void frontier_transmit(struct frontier_worker *w, unsigned int n)
+{
+	Status st = w->f->s->nodes.state[n];
+
+	if (st == SIR_SUSCEPTIBLE) {
+		frontier_move(w, n, SIR_INFECTED);
+		w->new_inf++;
+		if (node_vec_push(&w->infected, n) < 0)
+			w->failed = true;
+	}
+	/* counted as in sim_simulate() */
+	if (st != SIR_INFECTED || !w->f->day)
+		stats_inc(w->stats.processed[TRANSMIT]);
+	else
+		stats_inc(w->stats.skipped[TRANSMIT]);
+}
+
+static void frontier_recover(struct frontier_worker *w, unsigned int n)
+{
+	if (w->f->s->nodes.state[n] != SIR_RECOVERED) {
+		frontier_move(w, n, SIR_RECOVERED);
+		stats_inc(w->stats.processed[RECOVER]);
+	} else
+		stats_inc(w->stats.skipped[RECOVER]);
+}
+
+/* stands in for the order of insertion into the queue */
+static inline uint32_t frontier_hash(const Frontier *f, unsigned int n)
+{
+	return (n + f->s->rng.key[0]) * UINT64_C(0x9e3779b97f4a7c15) >> 32;
+}
+
+/* Applies the events of the round to their nodes. A node is met once
+ * for each event it has in the round, and applied at the first of them.
+ */
+static void frontier_apply(struct frontier_worker *w)
+{
+	Frontier *f = w->f;
+	const unsigned int *cur = f->cur.p;
+	size_t len = f->cur.length;
+	uint32_t day = f->day;
+
+	node_vec_clear(&w->infected);
+	for (;;) {
+		size_t i = atomic_fetch_add_explicit(&f->next, FRONTIER_CHUNK, memory_order_relaxed);
+		if (i >= len) break;
+		size_t end = i + FRONTIER_CHUNK < len ? i + FRONTIER_CHUNK : len;
+		for (; i < end; i++) {
+			unsigned int n = cur[i];
+			if (atomic_exchange_explicit(&f->visit[n], f->round, memory_order_relaxed) == f->round)
+				continue;
+			_Atomic uint64_t *p = &f->pending[2 * n];
+			uint64_t tr = atomic_load_explicit(p, memory_order_relaxed);
+			uint64_t rc = atomic_load_explicit(p + 1, memory_order_relaxed);
+			bool t = tr >> 32 == day, r = rc >> 32 == day;
+			/* or moved to an earlier day since */
+			if (!t && !r) {
+				f->rank[n] = 0;
+				continue;
+			}
+			if (t) atomic_store_explicit(p, FRONTIER_NONE, memory_order_relaxed);
+			if (r) atomic_store_explicit(p + 1, FRONTIER_NONE, memory_order_relaxed);
+			uint32_t sched = t ? (uint32_t) tr : (uint32_t) rc;
+			if (t && r && (uint32_t) rc < sched)
+				sched = rc;
+			f->before[n] = f->s->nodes.state[n];
+			f->rank[n] = (uint64_t) sched << 32 | frontier_hash(f, n);
+			/* on the same day, the event scheduled first goes first,
+			   as it would come first out of the queue; a tie goes
+			   to the TRANSMIT */
+			if (t && r && (uint32_t) rc < (uint32_t) tr) {
+				frontier_recover(w, n);
+				frontier_transmit(w, n);
+				continue;
+			}
+			if (t) frontier_transmit(w, n);
+			if (r) frontier_recover(w, n);
+		}
+	}
+}
+
+/* The atomic counterpart of sim_schedule(): the earlier of the two
+ * events stays, and a node whose event moved to another day is
+ * recorded under that day.
+ */
+static void frontier_schedule(struct frontier_worker *w, unsigned int n, EventType type, unsigned long ts)
+{
+	Frontier *f = w->f;
+	_Atomic uint64_t *p = &f->pending[2 * n + type - 1];
+	/* clamped before the current day, it runs later the same day */
+	if (ts < f->day) ts = f->day;
+	uint64_t key = (uint64_t) ts << 32 | f->day;
+	uint64_t old = atomic_load_explicit(p, memory_order_relaxed);
+
+	do {
+		if (old <= key) {
+			stats_inc(w->stats.superseded[type]);
+			return;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(p, &old, key, memory_order_relaxed,
+							memory_order_relaxed));
+	if (old != FRONTIER_NONE)
+		stats_inc(w->stats.superseded[type]);
+	stats_inc(w->stats.scheduled[type]);
+	/* past the horizon, or already recorded under this day */
+	if (ts >= f->s->cfg.time_max || old >> 32 == ts)
+		return;
+	if (node_vec_push(&w->due[ts], n) < 0)
+		w->failed = true;
+}
+
+/* state of n as the node with the given rank would have found it */
+static inline Status frontier_seen(const Frontier *f, uint64_t rank, unsigned int n)
+{
+	if (atomic_load_explicit(&f->visit[n], memory_order_relaxed) == f->round &&
+	    f->rank[n] > rank)
+		return f->before[n];
+	return f->s->nodes.state[n];
+}
+
+/* The nodes infected in the round spread to their neighbours, with the
+ * draws and the chained times of process_trans_SIR(). States are
+ * only read here.
+ */
+static void frontier_spread(struct frontier_worker *w)
+{
+	Frontier *f = w->f;
+	Sim *s = f->s;
+	Graph *g = s->g;
+	const unsigned int *inf = w->infected.p;
+	/* the RECOVER draw takes the bias of the TRANSMIT event there too */
+	double bias = s->cfg.prob_t;
+
+	for (size_t j = 0; j < w->infected.length; j++) {
+		size_t k, i = inf[j];
+		unsigned long ts = f->day;
+		graph_for_each_neigh(g, i, k) {
+			unsigned int n = g->adj[k];
+			Status seen = frontier_seen(f, f->rank[i], n);
+			if (seen == SIR_INFECTED) continue;
+			RngStream st;
+			rng_stream_init(&st, &s->rng, RNG_TRANSMIT, i, k - g->off[i]);
+			ts = toss_coin(&st, ts, bias, s->cfg.time_max);
+			if (seen == SIR_RECOVERED) continue;
+			frontier_schedule(w, n, TRANSMIT, ts);
+			rng_stream_init(&st, &s->rng, RNG_RECOVER, i, k - g->off[i]);
+			frontier_schedule(w, n, RECOVER,
+					  toss_coin(&st, ts, bias, s->cfg.time_max) + DETECT_DAYS);
+		}
+	}
+}
+
+/* Folds the round into the counts, and gathers the next round: more
+ * events on the same day, or the first day after with any. Days
+ * passed over are recorded.
+ */
+static void frontier_advance(Frontier *f)
+{
+	Sim *s = f->s;
+	NodeStore *ns = &s->nodes;
+
+	for (unsigned int i = 0; i < f->nr_threads; i++) {
+		struct frontier_worker *w = &f->workers[i];
+		for (int c = 0; c < _SIR_TYPE_MAX; c++) {
+			ns->count[c] += w->delta[c];
+			w->delta[c] = 0;
+		}
+		s->new_inf += w->new_inf;
+		w->new_inf = 0;
+		if (w->failed)
+			f->stop = true;
+	}
+	if (f->stop)
+		return;
+	for (; f->day < s->cfg.time_max; f->day++) {
+		node_vec_clear(&f->cur);
+		for (unsigned int i = 0; i < f->nr_threads; i++) {
+			struct node_vec *due = &f->workers[i].due[f->day];
+			if (node_vec_append(&f->cur, due->p, due->length) < 0) {
+				f->stop = true;
+				return;
+			}
+			node_vec_clear(due);
+		}
+		if (f->cur.length) {
+			f->round++;
+			atomic_store_explicit(&f->next, 0, memory_order_relaxed);
+			return;
+		}
+		sim_record(s, f->day);
+	}
+	f->stop = true;
+}
+
+static void* frontier_work(void *arg)
+{
+	struct frontier_worker *w = arg;
+	Frontier *f = w->f;
+
+	/* until the barrier is set up for the threads that started */
+	pthread_mutex_lock(&f->gate);
+	pthread_mutex_unlock(&f->gate);
+	for (;;) {
+		pthread_barrier_wait(&f->barrier);
+		if (f->stop) break;
+		frontier_apply(w);
+		pthread_barrier_wait(&f->barrier);
+		frontier_spread(w);
+		pthread_barrier_wait(&f->barrier);
+		if (!w->index)
+			frontier_advance(f);
+	}
+	return NULL;
+}
+
+/* Takes over the events sim_seed() queued in s, and runs them to the
+ * end, in place of sim_simulate(). No trace is written.
+ */
+bool frontier_simulate(Frontier *f, Sim *s)
+{
+	unsigned int started = 1;
+	bool ret = true;
+
+	if (s->cfg.time_max > UINT32_MAX - DETECT_DAYS) {
+		log_error("time_max must be below %u to simulate by day.", UINT32_MAX - DETECT_DAYS);
+		return false;
+	}
+	if (!frontier_reset(f, s) || !frontier_take_seed(f)) {
+		log_oom();
+		return false;
+	}
+	frontier_advance(f);
+	pthread_mutex_lock(&f->gate);
+	for (; started < f->nr_threads; started++) {
+		if (pthread_create(&f->workers[started].tid, NULL, frontier_work, &f->workers[started])) {
+			log_warn("Failed to start day thread %u.", started);
+			break;
+		}
+	}
+	/* the rounds are handed out in chunks, fewer threads only take longer */
+	pthread_barrier_init(&f->barrier, NULL, started);
+	pthread_mutex_unlock(&f->gate);
+	frontier_work(&f->workers[0]);
+	for (unsigned int i = 1; i < started; i++)
+		pthread_join(f->workers[i].tid, NULL);
+	pthread_barrier_destroy(&f->barrier);
+	for (unsigned int i = 0; i < f->nr_threads; i++) {
+		stats_merge(&s->stats, &f->workers[i].stats);
+		if (f->workers[i].failed)
+			ret = false;
+	}
+	stats_inc(s->stats.runs);
+	if (!ret) {
+		log_error("Failed to record the events of a day.");
+		log_oom();
+	}
+	return ret;
+}
@@ -0,0 +1,72 @@
+#ifndef FRONTIER_H
+#define FRONTIER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim.h"
+#include "stats.h"
+
+struct frontier_worker {
+	struct frontier *f;
+	pthread_t tid;
+	unsigned int index;
+	/* nodes given an event on each day by this thread, entries
+	   whose event has since moved earlier are dropped when met */
+	struct node_vec *due;
+	size_t nr_due;
+	/* nodes infected by this thread in the current round */
+	struct node_vec infected;
+	/* changes to the S/I/R counts in the current round */
+	ptrdiff_t delta[_SIR_TYPE_MAX];
+	size_t new_inf;
+	bool failed;
+	struct sim_stats stats;
+};
+
+/* Runs one replicate a day at a time on a fixed set of threads.
+ * All events of a day are applied to their nodes in parallel, then
+ * every node infected that day spreads to its neighbours in parallel.
+ * A neighbour applied the same day is seen as it was before, when its
+ * events were scheduled after those of the node, as the queue would
+ * have had it; ties go by a hash of the node. Neighbour events go
+ * through an atomic minimum on the pending day of the node, and land
+ * in buffers of the thread that made them, gathered when their day
+ * comes. Neither step depends on the order in which nodes are met,
+ * so the curve does not depend on the number of threads.
+ */
+struct frontier {
+	struct frontier_worker *workers;
+	unsigned int nr_threads;
+	Sim *s;
+	/* day << 32 | day scheduled of the queued TRANSMIT and RECOVER
+	   event of node i at 2i and 2i + 1, FRONTIER_NONE when none */
+	_Atomic uint64_t *pending;
+	/* round in which node i was last applied, its state before and
+	   its place among the nodes applied in that round */
+	_Atomic uint32_t *visit;
+	uint8_t *before;
+	uint64_t *rank;
+	size_t cap_nodes;
+	/* nodes with an event in the current round */
+	struct node_vec cur;
+	atomic_size_t next;
+	uint32_t day;
+	uint32_t round;
+	bool stop;
+	pthread_barrier_t barrier;
+	pthread_mutex_t gate;
+};
+
+typedef struct frontier Frontier;
+
+#define FRONTIER_NONE UINT64_MAX
+
+bool frontier_init(Frontier *f, unsigned int nr_threads);
+void frontier_release(Frontier *f);
+bool frontier_simulate(Frontier *f, Sim *s);
+
+#endif
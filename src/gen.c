@@ -0,0 +1,364 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "dist.h"
+#include "gen.h"
+#include "graph.h"
+#include "rng.h"
+#include "vector.h"
+#include "log.h"
+
+/* sub of the streams drawn from after the parallel phase, apart from
+   those of the blocks */
+#define GEN_SEQ (UINT64_C(1) << 32)
+
+/* a lattice edge of GRAPH_WS, and what became of it */
+struct ws_edge {
+	unsigned int u;
+	unsigned int v;
+	/* slot on the ring, 1 to nr_edges / 2 */
+	unsigned int j;
+	enum { WS_KEEP, WS_REWIRE, WS_DUP } fate;
+};
+
+struct gen_job {
+	const Config *cfg;
+	Rng rng;
+	size_t nr_blocks;
+	atomic_size_t next;
+	atomic_bool failed;
+	/* what each block made, in block order */
+	Vector **out;
+	bool (*block)(struct gen_job *job, size_t b, Vector *out);
+	/* chance of each pair for GRAPH_GNM */
+	double p;
+};
+
+/* uniform in [0, b), leaving out except unless it is -1 */
+size_t gen_random_id(RngStream *st, size_t b, size_t except)
+{
+	assert(b);
+	assert(except < b || except == (size_t) -1);
+	size_t r;
+	if (b == 1) return 0;
+	if (except == (size_t) -1)
+		return rng_bounded(st, b);
+	r = rng_bounded(st, b - 1);
+	return r < except ? r : r + 1;
+}
+
+static void block_range(const struct gen_job *job, size_t b, size_t *lo, size_t *hi)
+{
+	size_t n = job->cfg->sample_size;
+	*lo = b * GEN_BLOCK;
+	*hi = *lo + GEN_BLOCK < n ? *lo + GEN_BLOCK : n;
+}
+
+/* Every other node draws how many edges it makes, up to nr_edges, and
+   then their other ends. Duplicates are dropped later, in order. */
+static bool random_block(struct gen_job *job, size_t b, Vector *out)
+{
+	size_t n = job->cfg->sample_size, lo, hi;
+	block_range(job, b, &lo, &hi);
+	for (size_t i = lo + lo % 2; i < hi; i += 2) {
+		RngStream st;
+		rng_stream_init(&st, &job->rng, RNG_GRAPH, i, 0);
+		size_t c = gen_random_id(&st, job->cfg->nr_edges + 1, -1);
+		while (c--) {
+			struct edge e = { .a = i, .b = gen_random_id(&st, n, i) };
+			if (vector_push_back(out, &e) < 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+/* G(n, p) over the pairs (v, u), v < u, of the rows u in the block.
+ * Rather than a coin per pair, the gap to the next chosen pair is
+ * drawn from a geometric distribution (Batagelj and Brandes).
+ */
+static bool gnm_block(struct gen_job *job, size_t b, Vector *out)
+{
+	size_t lo, hi;
+	block_range(job, b, &lo, &hi);
+	uint64_t pairs = (uint64_t) hi * (hi - 1) / 2 - (lo ? (uint64_t) lo * (lo - 1) / 2 : 0);
+	uint64_t pos = 0, u = lo, v = 0;
+	RngStream st;
+
+	rng_stream_init(&st, &job->rng, RNG_GRAPH, b, GRAPH_GNM);
+	for (;;) {
+		uint64_t left = pairs - pos;
+		if (!left) break;
+		uint64_t skip = dist_geometric(&st, job->p, left + 1);
+		if (skip > left) break;
+		/* move to the chosen pair, row u has u of them */
+		for (v += skip - 1; v >= u; u++)
+			v -= u;
+		struct edge e = { .a = v, .b = u };
+		if (vector_push_back(out, &e) < 0)
+			return false;
+		pos += skip;
+		v++;
+	}
+	return true;
+}
+
+/* the ring lattice around the nodes in the block, with the edges to
+   rewire picked along with their new end */
+static bool ws_block(struct gen_job *job, size_t b, Vector *out)
+{
+	size_t n = job->cfg->sample_size, lo, hi;
+	unsigned int k2 = job->cfg->nr_edges / 2;
+	RngStream st;
+
+	block_range(job, b, &lo, &hi);
+	rng_stream_init(&st, &job->rng, RNG_GRAPH, b, GRAPH_WS);
+	for (size_t u = lo; u < hi; u++) {
+		for (unsigned int j = 1; j <= k2; j++) {
+			struct ws_edge e = { .u = u, .v = (u + j) % n, .j = j, .fate = WS_KEEP };
+			if (rng_uniform(&st) < job->cfg->rewire) {
+				e.v = rng_bounded(&st, n);
+				e.fate = WS_REWIRE;
+			}
+			if (vector_push_back(out, &e) < 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+static void* gen_work(void *arg)
+{
+	struct gen_job *job = arg;
+	for (;;) {
+		size_t b = atomic_fetch_add(&job->next, 1);
+		if (b >= job->nr_blocks || atomic_load(&job->failed))
+			break;
+		if (!job->block(job, b, job->out[b])) {
+			atomic_store(&job->failed, true);
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void gen_free(struct gen_job *job)
+{
+	for (size_t b = 0; job->out && b < job->nr_blocks; b++) {
+		if (job->out[b]) {
+			vector_reset(job->out[b]);
+			free(job->out[b]);
+		}
+	}
+	free(job->out);
+	job->out = NULL;
+}
+
+/* run job->block on every block, units of the given size go out */
+static bool gen_run(struct gen_job *job, unsigned int nr_threads, size_t unit)
+{
+	size_t n = job->cfg->sample_size;
+	pthread_t *tid = NULL;
+	unsigned int started = 0;
+
+	job->nr_blocks = (n + GEN_BLOCK - 1) / GEN_BLOCK;
+	atomic_init(&job->next, 0);
+	atomic_init(&job->failed, false);
+	job->out = calloc(job->nr_blocks, sizeof *job->out);
+	if (!job->out) return false;
+	for (size_t b = 0; b < job->nr_blocks; b++)
+		if (!(job->out[b] = vector_new(unit)))
+			return false;
+
+	if (nr_threads > job->nr_blocks)
+		nr_threads = job->nr_blocks;
+	/* this thread is one of them */
+	if (nr_threads > 1 && (tid = calloc(nr_threads - 1, sizeof *tid)))
+		for (; started < nr_threads - 1; started++)
+			if (pthread_create(tid + started, NULL, gen_work, job))
+				break;
+	gen_work(job);
+	for (unsigned int i = 0; i < started; i++)
+		pthread_join(tid[i], NULL);
+	free(tid);
+	return !atomic_load(&job->failed);
+}
+
+static bool gen_random(GraphBuilder *gb, struct gen_job *job, unsigned int nr_threads)
+{
+	job->block = random_block;
+	if (!gen_run(job, nr_threads, sizeof(struct edge)))
+		return false;
+	for (size_t b = 0; b < job->nr_blocks; b++) {
+		struct edge *e = (struct edge *) job->out[b]->p;
+		for (size_t i = 0; i < job->out[b]->length; i++)
+			if (graph_builder_connect(gb, e[i].a, e[i].b) < 0)
+				return false;
+	}
+	return true;
+}
+
+/* G(n, p) with p = m / pairs gives close to m edges, the difference is
+   made up by dropping or adding edges uniformly at random */
+static bool gen_gnm(GraphBuilder *gb, struct gen_job *job, unsigned int nr_threads)
+{
+	uint64_t n = job->cfg->sample_size;
+	uint64_t pairs = n * (n - 1) / 2, m = n * job->cfg->nr_edges / 2;
+	Vector *edges = gb->edges;
+	RngStream st;
+
+	if (m > pairs) m = pairs;
+	if (!m) return true;
+	job->p = (double) m / pairs;
+	job->block = gnm_block;
+	if (!gen_run(job, nr_threads, sizeof(struct edge)))
+		return false;
+	for (size_t b = 0; b < job->nr_blocks; b++)
+		if (vector_insert_many(edges, edges->length, job->out[b]->p, job->out[b]->length) < 0)
+			return false;
+
+	rng_stream_init(&st, &job->rng, RNG_GRAPH, 0, GEN_SEQ | GRAPH_GNM);
+	struct edge *e = (struct edge *) edges->p;
+	for (size_t c = edges->length; c > m; c--) {
+		/* move a random one of the first c edges past them */
+		size_t i = rng_bounded(&st, c);
+		struct edge t = e[i];
+		e[i] = e[c - 1];
+		e[c - 1] = t;
+	}
+	if (edges->length >= m) {
+		edges->length = m;
+		return true;
+	}
+	if (edge_set_reserve(&gb->set, m) < 0)
+		return false;
+	for (size_t i = 0; i < edges->length; i++)
+		edge_set_add(&gb->set, e[i].a, e[i].b);
+	while (edges->length < m) {
+		unsigned int a = rng_bounded(&st, n), b = rng_bounded(&st, n);
+		if (graph_builder_connect(gb, a, b) < 0)
+			return false;
+	}
+	return true;
+}
+
+/* Each node after the first ones attaches to nr_edges / 2 distinct
+ * nodes, picked with a chance in proportion to their degree by picking
+ * a uniform end of all edges so far. Sequential by its nature.
+ */
+static bool gen_ba(GraphBuilder *gb, struct gen_job *job)
+{
+	size_t n = job->cfg->sample_size, m0 = job->cfg->nr_edges / 2;
+	size_t core = m0 + 1 < n ? m0 + 1 : n;
+	Vector *ends = vector_new(sizeof(unsigned int));
+	RngStream st;
+	bool ret = false;
+
+	if (!ends) return false;
+	if (vector_reserve(ends, 2 * (core * (core - 1) / 2 + (n - core) * m0)) < 0)
+		goto out;
+	/* everyone starts out connected to everyone */
+	for (unsigned int a = 0; a < core; a++)
+		for (unsigned int b = a + 1; b < core; b++)
+			if (graph_builder_connect(gb, a, b) < 0)
+				goto out;
+	rng_stream_init(&st, &job->rng, RNG_GRAPH, 0, GRAPH_BA);
+	struct edge *e = (struct edge *) gb->edges->p;
+	for (size_t i = 0; i < gb->edges->length; i++) {
+		vector_push_back(ends, &e[i].a);
+		vector_push_back(ends, &e[i].b);
+	}
+	for (unsigned int v = core; v < n; v++) {
+		size_t first = gb->edges->length, nr_ends = ends->length;
+		/* ends of v's own edges only count from the next node */
+		for (size_t added = 0; added < m0;) {
+			unsigned int t = ((unsigned int *) ends->p)[rng_bounded(&st, nr_ends)];
+			int r = graph_builder_connect(gb, v, t);
+			if (r < 0) goto out;
+			added += r;
+		}
+		e = (struct edge *) gb->edges->p;
+		for (size_t i = first; i < gb->edges->length; i++) {
+			vector_push_back(ends, &e[i].a);
+			vector_push_back(ends, &e[i].b);
+		}
+	}
+	ret = true;
+out:
+	vector_reset(ends);
+	free(ends);
+	return ret;
+}
+
+/* A rewired edge takes a new end that is neither the node nor one of
+ * its neighbours at that point, drawn again as needed; the lattice
+ * edges left in place count as neighbours from the start.
+ */
+static bool gen_ws(GraphBuilder *gb, struct gen_job *job, unsigned int nr_threads)
+{
+	size_t n = job->cfg->sample_size;
+
+	job->block = ws_block;
+	if (!gen_run(job, nr_threads, sizeof(struct ws_edge)))
+		return false;
+	if (edge_set_reserve(&gb->set, n * (job->cfg->nr_edges / 2)) < 0)
+		return false;
+	for (size_t b = 0; b < job->nr_blocks; b++) {
+		struct ws_edge *e = (struct ws_edge *) job->out[b]->p;
+		for (size_t i = 0; i < job->out[b]->length; i++) {
+			if (e[i].fate != WS_KEEP) continue;
+			int r = e[i].u == e[i].v ? 0 : edge_set_add(&gb->set, e[i].u, e[i].v);
+			if (r < 0) return false;
+			if (!r) e[i].fate = WS_DUP;
+		}
+	}
+	for (size_t b = 0; b < job->nr_blocks; b++) {
+		struct ws_edge *e = (struct ws_edge *) job->out[b]->p;
+		for (size_t i = 0; i < job->out[b]->length; i++) {
+			struct edge ed = { .a = e[i].u, .b = e[i].v };
+			if (e[i].fate == WS_KEEP) {
+				if (vector_push_back(gb->edges, &ed) < 0)
+					return false;
+				continue;
+			}
+			if (e[i].fate != WS_REWIRE)
+				continue;
+			RngStream st;
+			rng_stream_init(&st, &job->rng, RNG_GRAPH, e[i].u, GEN_SEQ | e[i].j);
+			/* a node joined to nearly all others may find no end */
+			for (int tries = 0; tries < 64; tries++) {
+				if (ed.a != ed.b && !edge_set_has(&gb->set, ed.a, ed.b)) {
+					if (graph_builder_connect(gb, ed.a, ed.b) < 0)
+						return false;
+					break;
+				}
+				ed.b = rng_bounded(&st, n);
+			}
+		}
+	}
+	return true;
+}
+
+bool gen_graph(GraphBuilder *gb, const Config *cfg, unsigned int nr_threads)
+{
+	struct gen_job job = { .cfg = cfg };
+	bool ret;
+
+	assert(nr_threads);
+	/* the same graph for every replicate, so leave the replicate
+	   out of the key */
+	rng_init(&job.rng, cfg->rng, cfg->seed, 0);
+	switch (cfg->model) {
+	case GRAPH_GNM: ret = gen_gnm(gb, &job, nr_threads); break;
+	case GRAPH_BA: ret = gen_ba(gb, &job); break;
+	case GRAPH_WS: ret = gen_ws(gb, &job, nr_threads); break;
+	default: ret = gen_random(gb, &job, nr_threads); break;
+	}
+	gen_free(&job);
+	return ret;
+}
@@ -0,0 +1,20 @@
+#ifndef GEN_H
+#define GEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "graph.h"
+#include "rng.h"
+
+/* Nodes per random stream. Blocks are handed out to threads, but each
+ * block draws from its own stream, so the graph does not depend on the
+ * number of threads.
+ */
+#define GEN_BLOCK 4096U
+
+bool gen_graph(GraphBuilder *gb, const Config *cfg, unsigned int nr_threads);
+size_t gen_random_id(RngStream *st, size_t b, size_t except);
+
+#endif
@@ -1,145 +1,334 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "graph.h"
 #include "config.h"
 
-#define POOL_SIZE (SAMPLE_SIZE * (NR_EDGES + 1))
+/* room for nr nodes, all of them susceptible */
+bool node_store_reset(NodeStore *ns, size_t nr)
+{
+	size_t words = NODE_WORDS(nr);
+
+	if (nr > ns->cap) {
+		/* one chunk, sized for all the arrays */
+		size_t size = ARENA_ALIGN * (4 + _SIR_TYPE_MAX) + nr +
+			2 * nr * sizeof *ns->pending +
+			(1 + _SIR_TYPE_MAX) * words * sizeof(uint64_t);
+		node_store_release(ns);
+		arena_init(&ns->arena, size);
+		Arena *a = &ns->arena;
+		bool ok = (ns->state = arena_alloc(a, nr)) &&
+			(ns->pending = arena_alloc(a, 2 * nr * sizeof *ns->pending)) &&
+			(ns->initial = arena_alloc(a, words * sizeof *ns->initial));
+		for (int st = SIR_SUSCEPTIBLE; ok && st < _SIR_TYPE_MAX; st++)
+			ok = (ns->bits[st] = arena_alloc(a, words * sizeof(uint64_t)));
+		if (!ok) {
+			node_store_release(ns);
+			return false;
+		}
+		ns->cap = nr;
+	}
+	ns->nr = nr;
+	memset(ns->state, SIR_SUSCEPTIBLE, nr);
+	memset(ns->pending, 0, 2 * nr * sizeof *ns->pending);
+	memset(ns->initial, 0, words * sizeof *ns->initial);
+	for (int st = SIR_SUSCEPTIBLE; st < _SIR_TYPE_MAX; st++) {
+		memset(ns->bits[st], 0, words * sizeof *ns->bits[st]);
+		ns->count[st] = 0;
+	}
+	memset(ns->bits[SIR_SUSCEPTIBLE], 0xff, nr / 64 * sizeof(uint64_t));
+	if (nr % 64)
+		ns->bits[SIR_SUSCEPTIBLE][nr / 64] = (UINT64_C(1) << nr % 64) - 1;
+	ns->count[SIR_SUSCEPTIBLE] = nr;
+	return true;
+}
+
+void node_store_release(NodeStore *ns)
+{
+	arena_release(&ns->arena);
+	*ns = (NodeStore) {};
+}
+
+/* from the bitmap, rather than the running count */
+size_t node_store_count(const NodeStore *ns, Status st)
+{
+	size_t n = 0;
+	for (size_t w = 0; w < NODE_WORDS(ns->nr); w++)
+		n += __builtin_popcountll(ns->bits[st][w]);
+	return n;
+}
+
+void node_store_dump(const NodeStore *ns, Status st)
+{
+	log_sync();
+	for (size_t w = 0; w < NODE_WORDS(ns->nr); w++)
+		for (uint64_t b = ns->bits[st][w]; b; b &= b - 1)
+			fprintf(stderr, "%zu ", w * 64 + __builtin_ctzll(b) + 1);
+	fputc('\n', stderr);
+}
+
+static inline uint64_t edge_key(unsigned int a, unsigned int b)
+{
+	return a < b ? (uint64_t) a << 32 | b : (uint64_t) b << 32 | a;
+}
+
+static inline size_t edge_hash(const EdgeSet *s, uint64_t key)
+{
+	/* Fibonacci hashing, the top bits of the product mix best */
+	return ((key ^ key >> 29) * UINT64_C(0x9E3779B97F4A7C15)) >> s->shift;
+}
+
+static void edge_set_insert(EdgeSet *s, uint64_t key)
+{
+	size_t i = edge_hash(s, key);
+	while (s->slot[i])
+		i = (i + 1) & (s->cap - 1);
+	s->slot[i] = key;
+}
+
+/* make room for n edges in all without growing */
+int edge_set_reserve(EdgeSet *s, size_t n)
+{
+	size_t cap = 16;
+	unsigned int shift = 60;
+	while (cap < 2 * n) {
+		cap *= 2;
+		shift--;
+	}
+	if (cap <= s->cap) return 0;
+	uint64_t *slot = calloc(cap, sizeof *slot), *old = s->slot;
+	if (!slot) return -ENOMEM;
+	size_t old_cap = s->cap;
+	s->slot = slot;
+	s->cap = cap;
+	s->shift = shift;
+	for (size_t i = 0; i < old_cap; i++)
+		if (old[i])
+			edge_set_insert(s, old[i]);
+	free(old);
+	return 0;
+}
+
+void edge_set_clear(EdgeSet *s)
+{
+	if (s->slot)
+		memset(s->slot, 0, s->cap * sizeof *s->slot);
+	s->len = 0;
+}
 
-extern List ListS;
-extern List ListI;
-extern List ListR;
+void edge_set_release(EdgeSet *s)
+{
+	free(s->slot);
+	*s = (EdgeSet) {};
+}
 
-bool sir_list_add_item(Node *n, List *l)
+/* 1 if added, 0 if already there, negative errno on failure */
+int edge_set_add(EdgeSet *s, unsigned int a, unsigned int b)
 {
-	static size_t iterator = 0;
-	static struct sir *pool = NULL;
-	if (!l && !n) {
-		free(pool);
-		pool = NULL;
-		iterator = 0;
-		return true;
+	assert(a != b);
+	uint64_t key = edge_key(a, b);
+	if (2 * (s->len + 1) > s->cap) {
+		int r = edge_set_reserve(s, s->len ? 2 * s->len : 8);
+		if (r < 0) return r;
 	}
-	if (!pool) {
-		pool = malloc(POOL_SIZE * sizeof *pool);
-		if (!pool) return false;
+	size_t i = edge_hash(s, key);
+	for (; s->slot[i]; i = (i + 1) & (s->cap - 1))
+		if (s->slot[i] == key)
+			return 0;
+	s->slot[i] = key;
+	s->len++;
+	return 1;
+}
+
+bool edge_set_has(const EdgeSet *s, unsigned int a, unsigned int b)
+{
+	if (a == b || !s->len) return false;
+	uint64_t key = edge_key(a, b);
+	for (size_t i = edge_hash(s, key); s->slot[i]; i = (i + 1) & (s->cap - 1))
+		if (s->slot[i] == key)
+			return true;
+	return false;
+}
+
+bool graph_builder_init(GraphBuilder *b, size_t nr_nodes)
+{
+	assert(b);
+	if (!b->edges) {
+		b->edges = vector_new(sizeof(struct edge));
+		if (!b->edges) return false;
 	}
-	struct sir *s = NULL;
-	if (iterator < POOL_SIZE)
-		s = pool + iterator++;
-	if (!s) return false;
-	s->list.next = NULL;
-	list_append(l, &s->list);
-	s->item = n;
+	vector_clear(b->edges);
+	edge_set_clear(&b->set);
+	b->nr_nodes = nr_nodes;
 	return true;
 }
 
-void sir_list_add_sir(struct sir *s, List *l)
+void graph_builder_release(GraphBuilder *b)
 {
-	assert(s);
-	list_append(l, &s->list);
+	if (b->edges) {
+		vector_reset(b->edges);
+		free(b->edges);
+	}
+	edge_set_release(&b->set);
+	*b = (GraphBuilder) {};
 }
 
-struct sir* sir_list_del_item(Node *n, List *l)
+/* Record the edge between node indices a and b, unless it is a self
+ * loop or already there. 1 if recorded, 0 if not, negative errno on
+ * failure.
+ */
+int graph_builder_connect(GraphBuilder *gb, unsigned int a, unsigned int b)
 {
-	/* l is assumed to be anchor, not an object embedded in entry */
-	struct sir *i;
-	list_for_each_entry(i, l->next, struct sir, list) {
-		if (i->item == n) {
-			struct sir *f = container_of(&i->list, struct sir, list);
-			/* updates l->next */
-			list_delete(&l->next, &i->list);
-			/* freeing individual elements is not possible
-			   in pool based implementation */
-			// free(f);
-			f->list.next = NULL;
-			return f;
-		}
-	}
-	return NULL;
+	assert(gb);
+	assert(a < gb->nr_nodes && b < gb->nr_nodes);
+	if (a == b) return 0;
+	int r = edge_set_add(&gb->set, a, b);
+	if (r <= 0) return r;
+	struct edge e = { .a = a, .b = b };
+	if (vector_push_back(gb->edges, &e) < 0) return -ENOMEM;
+	return 1;
 }
 
-void sir_list_dump(List *l)
+bool graph_build(Graph *g, size_t sz, Vector *edges)
 {
-	struct sir *i;
-	list_for_each_entry(i, l->next, struct sir, list)
-		fprintf(stderr, "%u ", i->item->id);
-	log_info("");
+	assert(edges);
+	struct edge *e = (struct edge *) edges->p;
+	return graph_build_parts(g, sz, &e, &edges->length, 1);
 }
 
-void sir_list_del_rec(List *l)
+/* build from the edges of several arrays, in turn, without gathering
+   them in one place first */
+bool graph_build_parts(Graph *g, size_t sz, struct edge *const *parts,
+		       const size_t *lens, size_t nr_parts)
 {
-	if (!l->next) return;
-	struct sir *i;
-	/* we cannot use list_for_each_entry here, since we need to
-	 * advance the iterator and only then free the memory
-	 */
-	for (i = container_of(l->next, struct sir, list); i;) {
-		struct sir *f = i;
-		i = i->list.next ? container_of(i->list.next, struct sir, list) : NULL;
-		//sir_list_dump(&f->list, true);
-		free(f);
+	assert(g);
+	assert(!g->map);
+	size_t nr = 0;
+	for (size_t p = 0; p < nr_parts; p++)
+		nr += lens[p];
+	/* buffers of a previous build are reused when big enough, else
+	   both are mapped anew in one chunk of the right size */
+	if (sz + 1 > g->cap_off || 2 * nr > g->cap_adj || !g->adj) {
+		size_t nr_off = sz + 1, nr_adj = nr ? 2 * nr : 1;
+		arena_release(&g->arena);
+		arena_init(&g->arena, 3 * ARENA_ALIGN + nr_off * sizeof *g->off +
+			   nr_adj * sizeof *g->adj);
+		g->cap_off = g->cap_adj = 0;
+		g->off = arena_alloc(&g->arena, nr_off * sizeof *g->off);
+		g->adj = arena_alloc(&g->arena, nr_adj * sizeof *g->adj);
+		if (!g->off || !g->adj) {
+			arena_release(&g->arena);
+			g->off = NULL;
+			g->adj = NULL;
+			return false;
+		}
+		g->cap_off = nr_off;
+		g->cap_adj = nr_adj;
+	}
+	g->nr_nodes = sz;
+	g->nr_edges = nr;
+	memset(g->off, 0, (sz + 1) * sizeof *g->off);
+	/* count degrees, shifted by one so the prefix sum yields offsets */
+	for (size_t p = 0; p < nr_parts; p++) {
+		const struct edge *e = parts[p];
+		for (size_t i = 0; i < lens[p]; i++) {
+			g->off[e[i].a + 1]++;
+			g->off[e[i].b + 1]++;
+		}
 	}
-	l->next = NULL;
+	for (size_t i = 0; i < sz; i++)
+		g->off[i + 1] += g->off[i];
+	/* scatter, using off[i] as the fill cursor of node i; this keeps
+	   neighbours in the order the edges were made */
+	for (size_t p = 0; p < nr_parts; p++) {
+		const struct edge *e = parts[p];
+		for (size_t i = 0; i < lens[p]; i++) {
+			g->adj[g->off[e[i].a]++] = e[i].b;
+			g->adj[g->off[e[i].b]++] = e[i].a;
+		}
+	}
+	/* every cursor now sits at the start of the next node, shift back */
+	for (size_t i = sz; i > 0; i--)
+		g->off[i] = g->off[i - 1];
+	g->off[0] = 0;
+	return true;
 }
 
-size_t sir_list_len(List *l)
+static int cmp_uint(const void *a, const void *b)
 {
-	/* begin counting from next, as l is anchor */
-	size_t count = 0;
-	while (l->next) {
-		l = l->next;
-		count++;
+	unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+	return (x > y) - (x < y);
+}
+
+/* Sort each adjacency list and drop repeated neighbours and self
+ * loops, as edge lists from elsewhere often have edges in both
+ * directions. Returns the number of edges dropped.
+ */
+size_t graph_dedup(Graph *g)
+{
+	assert(!g->map);
+	size_t w = 0, start = 0, before = g->nr_edges;
+	for (size_t i = 0; i < g->nr_nodes; i++) {
+		size_t end = g->off[i + 1];
+		qsort(g->adj + start, end - start, sizeof *g->adj, cmp_uint);
+		g->off[i] = w;
+		for (size_t k = start; k < end; k++) {
+			if (g->adj[k] == i || (k > start && g->adj[k] == g->adj[k - 1]))
+				continue;
+			g->adj[w++] = g->adj[k];
+		}
+		start = end;
 	}
-	return count;
+	g->off[g->nr_nodes] = w;
+	g->nr_edges = w / 2;
+	return before - g->nr_edges;
 }
 
-Node* node_new(size_t sz)
+Graph* graph_new(size_t sz, Vector *edges)
 {
-	Node *n = malloc(sz * sizeof(*n));
-	if (!n) return NULL;
-	for (size_t i = 0; i < sz; i++) {
-		n[i].id = i + 1;
-		n[i].state = SIR_SUSCEPTIBLE;
-		n[i].neigh.next = NULL;
-		n[i].tail = &n[i].neigh;
-		n[i].initial = false;
+	Graph *g = calloc(1, sizeof *g);
+	if (!g) return NULL;
+	if (!graph_build(g, sz, edges)) {
+		graph_delete(g);
+		return NULL;
 	}
-	return n;
+	return g;
 }
 
-void node_connect(Node *a, Node *b)
+void graph_dump_adjacent_nodes(const Graph *g, size_t i)
 {
-	assert(a);
-	assert(b);
-	static bool conn_cache[SAMPLE_SIZE][SAMPLE_SIZE] = {};
-	struct sir *i;
-	if (a == b) return;
-	//list_for_each_entry(i, a->neigh.next, struct sir, list)
-	//	if (i->item == b) return;
-	if (!conn_cache[a->id-1][b->id-1] || !conn_cache[b->id-1][a->id-1]) {
-		assert(!conn_cache[a->id-1][b->id-1] && !conn_cache[b->id-1][a->id-1]);
-		conn_cache[a->id-1][b->id-1] = true;
-		conn_cache[b->id-1][a->id-1] = true;
-	} else return;
-	sir_list_add_item(a, b->tail);
-	b->tail = b->tail->next;
-	sir_list_add_item(b, a->tail);
-	a->tail = a->tail->next;
-	max_conn++;
+	size_t k;
+	log_sync();
+	/* node ids are one based */
+	fprintf(stderr, "Node %zu: ", i + 1);
+	graph_for_each_neigh(g, i, k)
+		fprintf(stderr, "%u ", g->adj[k] + 1);
+	fputc('\n', stderr);
 }
 
-void node_dump_adjacent_nodes(Node *n)
+/* free the buffers of g, but not g itself */
+void graph_release(Graph *g)
 {
-	fprintf(stderr, "Node %u: ", n->id);
-	sir_list_dump(&n->neigh);
+	if (g->map) {
+		munmap(g->map, g->map_len);
+		*g = (Graph) {};
+		return;
+	}
+	arena_release(&g->arena);
+	*g = (Graph) {};
 }
 
-void node_delete(Node *n)
+void graph_delete(Graph *g)
 {
-	sir_list_del_rec(&n->neigh);
+	if (!g) return;
+	graph_release(g);
+	free(g);
 }
@@ -1,109 +1,170 @@
 #ifndef GRAPH_H
 #define GRAPH_H
 
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "arena.h"
 #include "log.h"
 #include "config.h"
+#include "vector.h"
 
-static bool ptr_in(void *n, void **a)
-{
-	for (; *a; a++) if (*a == n) return true;
-	return false;
-}
+enum status {
+	SIR_SUSCEPTIBLE = 1,
+	SIR_INFECTED,
+	SIR_RECOVERED,
+	_SIR_TYPE_MAX,
+};
 
-static bool uint_in(size_t n, size_t *a)
-{
-	for (; *a != (size_t) -1; a++)
-		if (*a == n) return true;
-	return false;
-}
+typedef enum status Status;
 
-#define container_of(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
-/* conversion is implicit, since the pointer is in initializer
- * list, it's akin to doing arr[0] = ptr1; arr[1] = ptr2; ...
- * so this should be safe and generic for all pointer types
- */
-#define PTR_IN_SET(ptr, ...) (ptr_in((ptr), (void **) &(void *[]) { __VA_ARGS__, NULL }))
-/* don't pass SIZE_MAX here */
-#define UINT_IN_SET(x, ...) (uint_in((x), (size_t *) &(size_t []) { __VA_ARGS__, -1 }))
+struct pqevent;
 
-struct list {
-	struct list *next;
+#define NODE_WORDS(n) (((n) + 63) / 64)
+
+/* State of the nodes during a run, one array per field, so checking a
+ * node reads a single byte and nothing else. Each state also has a
+ * bitmap of its nodes, to count and list them with a word at a time.
+ * Nodes are indices into the arrays, their ids are one more.
+ */
+struct node_store {
+	size_t nr;
+	/* nodes the arrays have room for */
+	size_t cap;
+	/* Status of each node */
+	uint8_t *state;
+	/* bit i of bits[st] is set while node i is in state st */
+	uint64_t *bits[_SIR_TYPE_MAX];
+	/* kept up to date along with the bitmaps */
+	size_t count[_SIR_TYPE_MAX];
+	/* initial spreaders */
+	uint64_t *initial;
+	/* queued TRANSMIT and RECOVER event of node i at 2i and 2i + 1,
+	   at most one of each */
+	struct pqevent **pending;	/* the arrays above, in one chunk */
+	Arena arena;
 };
 
-typedef struct list List;
+typedef struct node_store NodeStore;
 
-static inline List* list_last(List *head)
+/* lists of node indices */
+VECTOR_DEFINE(unsigned int, node_vec)
+
+static inline bool bit_test(const uint64_t *b, size_t i)
 {
-	assert(head);
-	while (head->next)
-		head = head->next;
-	return head;
+	return b[i / 64] >> (i % 64) & 1;
 }
 
-static inline void list_append(List *head, List *what)
+static inline void bit_set(uint64_t *b, size_t i)
 {
-	List *t = list_last(head);
-	t->next = what;
+	b[i / 64] |= UINT64_C(1) << (i % 64);
 }
 
-static inline void list_delete(List **l, List *what)
+static inline void bit_clear(uint64_t *b, size_t i)
 {
-	while (*l && *l != what)
-		l = &(*l)->next;
-	if (!*l)
-		return;
-	/* l points to next field we want to update */
-	*l = what->next;
+	b[i / 64] &= ~(UINT64_C(1) << (i % 64));
 }
 
-/* iterator is of the type (List *) */
-#define list_for_each(i, list) for (i = (list); i; i = (list)->next)
-/* iterator is of the type (struct *) */
-#define list_for_each_entry(i, ptr, type, member)			\
-	for (i = (ptr) ? container_of((ptr), type, member) : NULL;	\
-	     i; i = i->member.next ? container_of(i->member.next, type, member) : NULL)
+static inline void node_move(NodeStore *ns, size_t i, Status to)
+{
+	Status from = ns->state[i];
+	assert(ns->count[from]);
+	bit_clear(ns->bits[from], i);
+	bit_set(ns->bits[to], i);
+	ns->count[from]--;
+	ns->count[to]++;
+	ns->state[i] = to;
+}
 
-extern size_t max_conn;
+static inline struct pqevent** node_pending(NodeStore *ns, size_t i, unsigned int type)
+{
+	/* TRANSMIT is 1, RECOVER 2 */
+	return &ns->pending[2 * i + type - 1];
+}
 
-enum status {
-	SIR_SUSCEPTIBLE = 1,
-	SIR_INFECTED,
-	SIR_RECOVERED,
-	_SIR_TYPE_MAX,
+/* undirected edge between two node indices, as recorded during generation */
+struct edge {
+	unsigned int a;
+	unsigned int b;
 };
 
-typedef enum status Status;
+/* Compressed sparse row adjacency, built once after generation. The
+ * neighbours of node i are adj[off[i]] up to adj[off[i + 1]] (exclusive),
+ * stored as node indices. Only the topology lives here, node state is
+ * kept by whoever runs on the graph, so one graph may back several runs.
+ */
+struct graph {
+	size_t nr_nodes;
+	/* number of undirected edges */
+	size_t nr_edges;
+	size_t *off;
+	unsigned int *adj;
+	/* allocated entries of off and adj */
+	size_t cap_off;
+	size_t cap_adj;
+	/* backs off and adj when they are built here */
+	Arena arena;
+	/* off and adj point into this read-only mapping of a snapshot,
+	   instead of owned buffers */
+	void *map;
+	size_t map_len;
+};
 
-struct sir {
-	struct node *item;
-	struct list list;
+typedef struct graph Graph;
+
+/* Set of undirected edges, open addressing over the key
+ * min(a, b) << 32 | max(a, b). No edge has the key 0, a self loop,
+ * which marks empty slots. Memory is linear in the number of edges.
+ */
+struct edge_set {
+	uint64_t *slot;
+	/* a power of two, kept at least twice len */
+	size_t cap;
+	size_t len;
+	unsigned int shift;
 };
 
-struct node {
-	/* node id */
-	unsigned int id;
-	/* node state */
-	Status state;
-	/* node adjacency list anchor */
-	List neigh;
-	List *tail;
-	bool initial;
+typedef struct edge_set EdgeSet;
+
+/* Edges being made during generation, with a set of them to reject
+ * duplicates. Kept across runs to reuse the buffers.
+ */
+struct graph_builder {
+	Vector *edges;
+	EdgeSet set;
+	size_t nr_nodes;
 };
 
-typedef struct node Node;
+typedef struct graph_builder GraphBuilder;
+
+/* iterator k is of the type size_t, neighbour is (g)->adj[k] */
+#define graph_for_each_neigh(g, i, k) \
+	for (k = (g)->off[(i)]; k < (g)->off[(i) + 1]; k++)
+
+bool node_store_reset(NodeStore *ns, size_t nr);
+void node_store_release(NodeStore *ns);
+size_t node_store_count(const NodeStore *ns, Status st);
+void node_store_dump(const NodeStore *ns, Status st);
+
+int edge_set_reserve(EdgeSet *s, size_t n);
+void edge_set_clear(EdgeSet *s);
+void edge_set_release(EdgeSet *s);
+int edge_set_add(EdgeSet *s, unsigned int a, unsigned int b);
+bool edge_set_has(const EdgeSet *s, unsigned int a, unsigned int b);
+
 
-bool sir_list_add_item(Node *n, List *l);
-void sir_list_add_sir(struct sir *s, List *l);
-struct sir* sir_list_del_item(Node *n, List *l);
-void sir_list_dump(List *l);
-void sir_list_del_rec(List *l);
-size_t sir_list_len(List *l);
+bool graph_builder_init(GraphBuilder *b, size_t nr_nodes);
+int graph_builder_connect(GraphBuilder *gb, unsigned int a, unsigned int b);
+void graph_builder_release(GraphBuilder *b);
 
-Node* node_new(size_t sz);
-void node_connect(Node *a, Node *b);
-void node_dump_adjacent_nodes(Node *n);
-void node_delete(Node *n);
+bool graph_build(Graph *g, size_t sz, Vector *edges);
+bool graph_build_parts(Graph *g, size_t sz, struct edge *const *parts,
+		       const size_t *lens, size_t nr_parts);
+size_t graph_dedup(Graph *g);
+Graph* graph_new(size_t sz, Vector *edges);
+void graph_dump_adjacent_nodes(const Graph *g, size_t i);
+void graph_release(Graph *g);
+void graph_delete(Graph *g);
 
 #endif
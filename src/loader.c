@@ -0,0 +1,378 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "graph.h"
+#include "loader.h"
+#include "vector.h"
+#include "log.h"
+
+/* The edge list is text with one edge per line, two 0-based node ids
+ * separated by blanks and anything after them ignored, such as a
+ * weight. Lines starting with # or % are comments. The mapped file is
+ * cut into one chunk per thread at line boundaries, and each thread
+ * collects the edges of its chunk.
+ */
+struct parser {
+	pthread_t tid;
+	const char *p;
+	const char *end;
+	Vector *edges;
+	unsigned int max_id;
+	/* where parsing stopped on a bad line, or NULL */
+	const char *bad;
+};
+
+static bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+static const char* parse_id(const char *p, const char *end, unsigned int *id)
+{
+	uint64_t v = 0;
+	const char *s = p;
+	while (p < end && *p >= '0' && *p <= '9') {
+		v = v * 10 + (*p++ - '0');
+		/* node ids are 1-based unsigned ints in the simulation */
+		if (v >= UINT_MAX - 1) return NULL;
+	}
+	if (p == s) return NULL;
+	*id = v;
+	return p;
+}
+
+static void* parse_chunk(void *arg)
+{
+	struct parser *ps = arg;
+	const char *p = ps->p, *end = ps->end;
+
+	while (p < end) {
+		const char *line = p;
+		struct edge e;
+		while (p < end && is_blank(*p)) p++;
+		if (p == end) break;
+		if (*p == '\n' || *p == '#' || *p == '%')
+			goto next;
+		if (!(p = parse_id(p, end, &e.a)))
+			goto bad;
+		while (p < end && is_blank(*p)) p++;
+		if (!(p = parse_id(p, end, &e.b)))
+			goto bad;
+		if (p < end && !is_blank(*p) && *p != '\n')
+			goto bad;
+		if (e.a > ps->max_id) ps->max_id = e.a;
+		if (e.b > ps->max_id) ps->max_id = e.b;
+		if (e.a != e.b && vector_push_back(ps->edges, &e) < 0) {
+			ps->bad = line;
+			return NULL;
+		}
+next:
+		p = memchr(p, '\n', end - p);
+		p = p ? p + 1 : end;
+		continue;
+bad:
+		ps->bad = line;
+		return NULL;
+	}
+	return NULL;
+}
+
+/* start of the line that follows p */
+static const char* line_after(const char *p, const char *begin, const char *end)
+{
+	if (p == begin) return p;
+	const char *nl = memchr(p - 1, '\n', end - (p - 1));
+	return nl ? nl + 1 : end;
+}
+
+static size_t line_number(const char *begin, const char *p)
+{
+	size_t n = 1;
+	for (; begin < p; begin++)
+		n += *begin == '\n';
+	return n;
+}
+
+bool graph_load_edges(Graph *g, const char *path, unsigned int nr_threads)
+{
+	struct parser *ps = NULL;
+	struct edge **parts = NULL;
+	size_t *lens = NULL;
+	struct stat st;
+	char *map = NULL;
+	bool ret = false;
+	int fd;
+
+	assert(nr_threads);
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log_error("Failed to open edge list %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	if (!st.st_size) {
+		log_error("Edge list %s is empty.", path);
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_error("Failed to map edge list %s: %s", path, strerror(errno));
+		return false;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	/* a chunk per thread, but not tiny ones */
+	if (nr_threads > st.st_size / 65536 + 1)
+		nr_threads = st.st_size / 65536 + 1;
+	ps = calloc(nr_threads, sizeof *ps);
+	parts = calloc(nr_threads, sizeof *parts);
+	lens = calloc(nr_threads, sizeof *lens);
+	if (!ps || !parts || !lens)
+		goto oom;
+	const char *end = map + st.st_size;
+	for (unsigned int i = 0; i < nr_threads; i++) {
+		ps[i].p = line_after(map + st.st_size / nr_threads * i, map, end);
+		ps[i].end = i + 1 < nr_threads ?
+			line_after(map + st.st_size / nr_threads * (i + 1), map, end) : end;
+		ps[i].edges = vector_new(sizeof(struct edge));
+		/* a first guess from the chunk size, short lines are ~12 bytes */
+		if (!ps[i].edges || vector_reserve(ps[i].edges, (ps[i].end - ps[i].p) / 12 + 1) < 0)
+			goto oom;
+	}
+
+	/* chunk 0 is parsed here */
+	unsigned int started = 1;
+	for (; started < nr_threads; started++)
+		if (pthread_create(&ps[started].tid, NULL, parse_chunk, ps + started))
+			break;
+	parse_chunk(ps);
+	/* chunks whose thread did not start are also parsed here */
+	for (unsigned int i = started; i < nr_threads; i++)
+		parse_chunk(ps + i);
+	for (unsigned int i = 1; i < started; i++)
+		pthread_join(ps[i].tid, NULL);
+
+	unsigned int max_id = 0;
+	for (unsigned int i = 0; i < nr_threads; i++) {
+		if (ps[i].bad) {
+			log_error("%s:%zu: expected two node ids.", path, line_number(map, ps[i].bad));
+			goto out;
+		}
+		if (ps[i].max_id > max_id)
+			max_id = ps[i].max_id;
+		parts[i] = (struct edge *) ps[i].edges->p;
+		lens[i] = ps[i].edges->length;
+	}
+	*g = (Graph) {};
+	if (!graph_build_parts(g, (size_t) max_id + 1, parts, lens, nr_threads))
+		goto oom;
+	size_t dup = graph_dedup(g);
+	if (dup)
+		log_info("Dropped %zu repeated edges from %s.", dup, path);
+	ret = true;
+	goto out;
+oom:
+	log_oom();
+out:
+	for (unsigned int i = 0; ps && i < nr_threads; i++) {
+		if (ps[i].edges) {
+			vector_reset(ps[i].edges);
+			free(ps[i].edges);
+		}
+	}
+	free(ps);
+	free(parts);
+	free(lens);
+	munmap(map, st.st_size);
+	return ret;
+}
+
+static bool write_all(int fd, const void *p, size_t n)
+{
+	while (n) {
+		ssize_t r = write(fd, p, n);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p = (const char *) p + r;
+		n -= r;
+	}
+	return true;
+}
+
+/* written to a temporary file first, so that a snapshot is either
+   complete or missing */
+bool graph_snapshot_write(const Graph *g, const char *path)
+{
+	struct snapshot_header h = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.off_size = sizeof *g->off,
+		.adj_size = sizeof *g->adj,
+		.nr_nodes = g->nr_nodes,
+		.nr_edges = g->nr_edges,
+	};
+	size_t nr_adj = g->off[g->nr_nodes];
+	char tmp[PATH_MAX];
+	int fd;
+
+	/* keep the arrays aligned for their types */
+	h.off_pos = (sizeof h + 63) & ~(uint64_t) 63;
+	h.adj_pos = (h.off_pos + (g->nr_nodes + 1) * sizeof *g->off + 63) & ~(uint64_t) 63;
+	if (snprintf(tmp, sizeof tmp, "%s.tmp", path) >= (int) sizeof tmp) {
+		log_error("Snapshot path %s is too long.", path);
+		return false;
+	}
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("Failed to create snapshot %s: %s", tmp, strerror(errno));
+		return false;
+	}
+	static const char zero[64];
+	if (!write_all(fd, &h, sizeof h) ||
+	    !write_all(fd, zero, h.off_pos - sizeof h) ||
+	    !write_all(fd, g->off, (g->nr_nodes + 1) * sizeof *g->off) ||
+	    !write_all(fd, zero, h.adj_pos - h.off_pos - (g->nr_nodes + 1) * sizeof *g->off) ||
+	    !write_all(fd, g->adj, nr_adj * sizeof *g->adj) ||
+	    close(fd) < 0) {
+		log_error("Failed to write snapshot %s: %s", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		return false;
+	}
+	if (rename(tmp, path) < 0) {
+		log_error("Failed to rename snapshot %s: %s", tmp, strerror(errno));
+		unlink(tmp);
+		return false;
+	}
+	return true;
+}
+
+/* Everything the simulation will read is checked once, offsets and
+ * neighbours included, so a truncated or corrupt file is refused
+ * rather than read out of bounds. Sizes are compared without
+ * multiplying past the end of a uint64_t.
+ */
+static bool snapshot_valid(const struct snapshot_header *h, uint64_t size)
+{
+	if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof h->magic) || h->version != SNAPSHOT_VERSION ||
+	    h->off_size != sizeof(size_t) || h->adj_size != sizeof(unsigned int) ||
+	    h->nr_nodes >= UINT_MAX || h->off_pos % sizeof(size_t) ||
+	    h->adj_pos % sizeof(unsigned int) || h->off_pos < sizeof *h ||
+	    h->off_pos > size || h->adj_pos > size ||
+	    h->nr_nodes + 1 > (size - h->off_pos) / sizeof(size_t))
+		return false;
+	const size_t *off = (const size_t *) ((const char *) h + h->off_pos);
+	size_t n = h->nr_nodes, nr_adj = off[n];
+	if (off[0] || nr_adj % 2 || nr_adj / 2 != h->nr_edges ||
+	    nr_adj > (size - h->adj_pos) / sizeof(unsigned int))
+		return false;
+	for (size_t i = 0; i < n; i++)
+		if (off[i] > off[i + 1])
+			return false;
+	const unsigned int *adj = (const unsigned int *) ((const char *) h + h->adj_pos);
+	for (size_t k = 0; k < nr_adj; k++)
+		if (adj[k] >= n)
+			return false;
+	return true;
+}
+
+/* Map the snapshot at path as g, read-only. The pages are read once to
+   check them, and are backed by the file, so the graph may exceed memory. */
+bool graph_snapshot_map(Graph *g, const char *path)
+{
+	const struct snapshot_header *h;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log_error("Failed to open snapshot %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	if ((size_t) st.st_size < sizeof *h) {
+		log_error("Snapshot %s is too short.", path);
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_error("Failed to map snapshot %s: %s", path, strerror(errno));
+		return false;
+	}
+	h = map;
+	if (!snapshot_valid(h, st.st_size))
+		goto bad;
+	const size_t *off = (const size_t *) ((const char *) map + h->off_pos);
+
+	*g = (Graph) {
+		.nr_nodes = h->nr_nodes,
+		.nr_edges = h->nr_edges,
+		.off = (size_t *) off,
+		.adj = (unsigned int *) ((char *) map + h->adj_pos),
+		.map = map,
+		.map_len = st.st_size,
+	};
+	return true;
+bad:
+	log_error("%s is not a usable version %u snapshot.", path, SNAPSHOT_VERSION);
+	munmap(map, st.st_size);
+	return false;
+}
+
+/* A snapshot is mapped as is. An edge list is parsed, unless its
+ * snapshot next to it is at least as new, and a snapshot is left
+ * behind for next time.
+ */
+bool graph_load(Graph *g, const char *path, unsigned int nr_threads)
+{
+	char magic[sizeof SNAPSHOT_MAGIC - 1], snap[PATH_MAX];
+	struct stat st, sst;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log_error("Failed to open graph %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	bool is_snap = read(fd, magic, sizeof magic) == sizeof magic &&
+		!memcmp(magic, SNAPSHOT_MAGIC, sizeof magic);
+	close(fd);
+	if (is_snap)
+		return graph_snapshot_map(g, path);
+
+	if (snprintf(snap, sizeof snap, "%s" SNAPSHOT_SUFFIX, path) >= (int) sizeof snap) {
+		log_error("Graph path %s is too long.", path);
+		return false;
+	}
+	if (!stat(snap, &sst) && (sst.st_mtim.tv_sec > st.st_mtim.tv_sec ||
+				  (sst.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+				   sst.st_mtim.tv_nsec >= st.st_mtim.tv_nsec))) {
+		if (graph_snapshot_map(g, snap))
+			return true;
+		log_warn("Parsing %s instead.", path);
+	}
+	if (!graph_load_edges(g, path, nr_threads))
+		return false;
+	if (!graph_snapshot_write(g, snap))
+		log_warn("Continuing without a snapshot of %s.", path);
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "graph.h"
+
+/* A snapshot is the CSR arrays of a graph behind a header, laid out to
+ * be mapped and used in place. Positions are from the start of the
+ * file, so it does not matter where it ends up mapped.
+ */
+#define SNAPSHOT_MAGIC   "SIRGRAPH"
+#define SNAPSHOT_VERSION 1U
+/* appended to the path of an edge list for its snapshot */
+#define SNAPSHOT_SUFFIX  ".csr"
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	/* sizeof(*off) and sizeof(*adj) of the writer */
+	uint16_t off_size;
+	uint16_t adj_size;
+	uint64_t nr_nodes;
+	uint64_t nr_edges;
+	/* nr_nodes + 1 entries */
+	uint64_t off_pos;
+	/* off[nr_nodes] entries */
+	uint64_t adj_pos;
+};
+
+bool graph_load(Graph *g, const char *path, unsigned int nr_threads);
+bool graph_load_edges(Graph *g, const char *path, unsigned int nr_threads);
+bool graph_snapshot_write(const Graph *g, const char *path);
+bool graph_snapshot_map(Graph *g, const char *path);
+
+#endif
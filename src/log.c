@@ -0,0 +1,393 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "log.h"
+
+const char *const lev2str[_LOG_LEVEL_MAX] = {
+	[LOG_TRACE] = "TRCE",
+	[LOG_INFO] = "INFO",
+	[LOG_WARN] = "WARN",
+	[LOG_FAIL] = "FAIL",
+};
+
+enum log_level log_threshold = LOG_INFO;
+/* only changed while no other thread logs */
+bool log_async_on;
+
+/* Asynchronous logging: the caller only copies the format pointer and
+ * the raw arguments into a fixed size record of a bounded ring, and a
+ * background thread formats them. The ring is the array based queue
+ * of Vyukov, so concurrent callers never take a lock. Only when it is
+ * full does a caller wait, for the log thread to make room.
+ */
+#define LOG_RING_NR  4096U
+#define LOG_ARGS_MAX 8U
+/* room for the strings of a record, e.g. a path and an error */
+#define LOG_STR_MAX  256U
+
+union log_arg {
+	long long i;
+	unsigned long long u;
+	double d;
+	const void *p;
+	/* offset of a copied string in str */
+	size_t off;
+};
+
+struct log_record {
+	/* position this slot is free for, or one past it once written */
+	atomic_size_t seq;
+	enum log_level lev;
+	unsigned int nr_args;
+	/* NULL when the caller printed the message itself */
+	const char *fmt;
+	union log_arg args[LOG_ARGS_MAX];
+	char str[LOG_STR_MAX];
+} __attribute__((aligned(64)));
+
+static struct {
+	struct log_record *ring;
+	/* next position to hand out to a writer */
+	atomic_size_t tail;
+	/* next position to format */
+	atomic_size_t head;
+	/* writers that found the ring full */
+	atomic_size_t stalls;
+	atomic_bool stop;
+	pthread_t tid;
+} logq;
+
+enum conv_len {
+	LEN_NONE,
+	LEN_HH,
+	LEN_H,
+	LEN_L,
+	LEN_LL,
+	LEN_Z,
+	LEN_J,
+	LEN_T,
+	LEN_LD,
+};
+
+/* one conversion specification, after its % */
+struct conv {
+	/* flags, width and precision */
+	const char *spec;
+	size_t spec_len;
+	unsigned int stars;
+	enum conv_len len;
+	char type;
+};
+
+static const char* parse_conv(const char *p, struct conv *c)
+{
+	*c = (struct conv) { .spec = p };
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+	for (int part = 0; part < 2; part++) {
+		if (part && *p != '.')
+			break;
+		if (part) p++;
+		if (*p == '*') {
+			c->stars++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	c->spec_len = p - c->spec;
+	switch (*p) {
+	case 'h': c->len = p[1] == 'h' ? (p++, LEN_HH) : LEN_H; p++; break;
+	case 'l': c->len = p[1] == 'l' ? (p++, LEN_LL) : LEN_L; p++; break;
+	case 'q': c->len = LEN_LL; p++; break;
+	case 'z': c->len = LEN_Z; p++; break;
+	case 'j': c->len = LEN_J; p++; break;
+	case 't': c->len = LEN_T; p++; break;
+	case 'L': c->len = LEN_LD; p++; break;
+	}
+	c->type = *p;
+	return *p ? p + 1 : p;
+}
+
+static long long arg_signed(va_list *ap, enum conv_len len)
+{
+	switch (len) {
+	case LEN_HH: return (signed char) va_arg(*ap, int);
+	case LEN_H: return (short) va_arg(*ap, int);
+	case LEN_L: return va_arg(*ap, long);
+	case LEN_LL: return va_arg(*ap, long long);
+	case LEN_Z: return va_arg(*ap, ssize_t);
+	case LEN_J: return va_arg(*ap, intmax_t);
+	case LEN_T: return va_arg(*ap, ptrdiff_t);
+	default: return va_arg(*ap, int);
+	}
+}
+
+static unsigned long long arg_unsigned(va_list *ap, enum conv_len len)
+{
+	switch (len) {
+	case LEN_HH: return (unsigned char) va_arg(*ap, unsigned int);
+	case LEN_H: return (unsigned short) va_arg(*ap, unsigned int);
+	case LEN_L: return va_arg(*ap, unsigned long);
+	case LEN_LL: return va_arg(*ap, unsigned long long);
+	case LEN_Z: return va_arg(*ap, size_t);
+	case LEN_J: return va_arg(*ap, uintmax_t);
+	case LEN_T: return va_arg(*ap, ptrdiff_t);
+	default: return va_arg(*ap, unsigned int);
+	}
+}
+
+/* Copy the arguments of fmt into r, as wide as they get. Conversions
+ * past LOG_ARGS_MAX arguments are left out. False when the strings were
+ * cut to fit into r.
+ */
+static bool record_args(struct log_record *r, const char *fmt, va_list *ap)
+{
+	size_t str = 0;
+	bool fit = true;
+	r->nr_args = 0;
+	for (const char *p = strchr(fmt, '%'); p; p = strchr(p, '%')) {
+		struct conv c;
+		p = parse_conv(p + 1, &c);
+		if (c.type == '%')
+			continue;
+		if (r->nr_args + c.stars + 1 > LOG_ARGS_MAX)
+			break;
+		union log_arg *a = r->args + r->nr_args;
+		for (unsigned int i = 0; i < c.stars; i++)
+			(a++)->i = va_arg(*ap, int);
+		switch (c.type) {
+		case 'd': case 'i':
+			a->i = arg_signed(ap, c.len);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			a->u = arg_unsigned(ap, c.len);
+			break;
+		case 'c':
+			a->i = va_arg(*ap, int);
+			break;
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			a->d = c.len == LEN_LD ? va_arg(*ap, long double) : va_arg(*ap, double);
+			break;
+		case 's': {
+			/* the string may not outlive the call, copy it */
+			const char *s = va_arg(*ap, const char *);
+			size_t n = s ? strlen(s) : 0;
+			if (n > LOG_STR_MAX - 1 - str) {
+				n = LOG_STR_MAX - 1 - str;
+				fit = false;
+			}
+			memcpy(r->str + str, s ? s : "", n);
+			r->str[str + n] = '\0';
+			a->off = str;
+			str += n + (str + n < LOG_STR_MAX - 1);
+			break;
+		}
+		case 'p':
+			a->p = va_arg(*ap, void *);
+			break;
+		default:
+			/* %n and anything unknown end the message */
+			return fit;
+		}
+		r->nr_args += c.stars + 1;
+	}
+	return fit;
+}
+
+void log_async_write(enum log_level lev, const char *fmt, ...)
+{
+	struct log_record *r;
+	size_t pos = atomic_load_explicit(&logq.tail, memory_order_relaxed);
+	for (;;) {
+		r = &logq.ring[pos & (LOG_RING_NR - 1)];
+		size_t seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+		ptrdiff_t dif = (ptrdiff_t) (seq - pos);
+		if (!dif) {
+			if (atomic_compare_exchange_weak_explicit(&logq.tail, &pos, pos + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			/* full, wait for the log thread to catch up */
+			atomic_fetch_add_explicit(&logq.stalls, 1, memory_order_relaxed);
+			sched_yield();
+			pos = atomic_load_explicit(&logq.tail, memory_order_relaxed);
+		} else {
+			pos = atomic_load_explicit(&logq.tail, memory_order_relaxed);
+		}
+	}
+	va_list ap;
+	va_start(ap, fmt);
+	r->lev = lev;
+	bool fit = record_args(r, fmt, &ap);
+	r->fmt = fit ? fmt : NULL;
+	va_end(ap);
+	atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+	if (fit)
+		return;
+	/* rather than cut the strings, print the message here, after
+	   everything queued before it */
+	log_async_flush();
+	flockfile(stderr);
+	log_more(lev);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	funlockfile(stderr);
+}
+
+/* Rebuild a specification with the stars filled in and the length
+ * modifier of the widened argument, and print one argument with it.
+ */
+static void print_conv(FILE *f, const struct conv *c, const struct log_record *r,
+		       const union log_arg *a)
+{
+	char spec[64];
+	size_t n = 0;
+	spec[n++] = '%';
+	for (size_t i = 0; i < c->spec_len && n < sizeof spec - 24; i++) {
+		if (c->spec[i] == '*')
+			n += snprintf(spec + n, sizeof spec - n, "%d", (int) (a++)->i);
+		else
+			spec[n++] = c->spec[i];
+	}
+	switch (c->type) {
+	case 'd': case 'i':
+		snprintf(spec + n, sizeof spec - n, "ll%c", c->type);
+		fprintf(f, spec, a->i);
+		break;
+	case 'u': case 'o': case 'x': case 'X':
+		snprintf(spec + n, sizeof spec - n, "ll%c", c->type);
+		fprintf(f, spec, a->u);
+		break;
+	case 'c':
+		snprintf(spec + n, sizeof spec - n, "c");
+		fprintf(f, spec, (int) a->i);
+		break;
+	case 's':
+		snprintf(spec + n, sizeof spec - n, "s");
+		fprintf(f, spec, r->str + a->off);
+		break;
+	case 'p':
+		snprintf(spec + n, sizeof spec - n, "p");
+		fprintf(f, spec, a->p);
+		break;
+	default:
+		snprintf(spec + n, sizeof spec - n, "%c", c->type);
+		fprintf(f, spec, a->d);
+		break;
+	}
+}
+
+static void record_print(FILE *f, const struct log_record *r)
+{
+	const char *p = r->fmt, *q;
+	unsigned int arg = 0;
+#ifdef LOG_DEBUG
+	fprintf(f, "(%s) ", lev2str[r->lev]);
+#endif
+	while ((q = strchr(p, '%'))) {
+		struct conv c;
+		fwrite(p, 1, q - p, f);
+		p = parse_conv(q + 1, &c);
+		if (c.type == '%') {
+			fputc('%', f);
+			continue;
+		}
+		if (arg + c.stars + 1 > r->nr_args) {
+			fputs("...", f);
+			p = "";
+			break;
+		}
+		print_conv(f, &c, r, r->args + arg);
+		arg += c.stars + 1;
+	}
+	fputs(p, f);
+	fputc('\n', f);
+}
+
+static void* log_async_thread(void *arg)
+{
+	size_t head = atomic_load_explicit(&logq.head, memory_order_relaxed);
+	(void) arg;
+	for (;;) {
+		struct log_record *r = &logq.ring[head & (LOG_RING_NR - 1)];
+		if (atomic_load_explicit(&r->seq, memory_order_acquire) == head + 1) {
+			if (r->fmt) {
+				/* whole lines, between those printed by writers */
+				flockfile(stderr);
+				record_print(stderr, r);
+				funlockfile(stderr);
+			}
+			atomic_store_explicit(&r->seq, head + LOG_RING_NR, memory_order_release);
+			atomic_store_explicit(&logq.head, ++head, memory_order_release);
+			continue;
+		}
+		/* writers are gone once stop is set */
+		if (atomic_load(&logq.stop) && atomic_load(&logq.tail) == head)
+			break;
+		fflush(stderr);
+		nanosleep(&(struct timespec) { .tv_nsec = 200000 }, NULL);
+	}
+	fflush(stderr);
+	return NULL;
+}
+
+/* call before any other thread logs */
+bool log_async_start(void)
+{
+	assert(!log_async_on);
+	logq.ring = aligned_alloc(_Alignof(struct log_record), LOG_RING_NR * sizeof *logq.ring);
+	if (!logq.ring)
+		return false;
+	for (size_t i = 0; i < LOG_RING_NR; i++)
+		atomic_init(&logq.ring[i].seq, i);
+	atomic_init(&logq.tail, 0);
+	atomic_init(&logq.head, 0);
+	atomic_init(&logq.stalls, 0);
+	atomic_init(&logq.stop, false);
+	if (pthread_create(&logq.tid, NULL, log_async_thread, NULL)) {
+		free(logq.ring);
+		logq.ring = NULL;
+		return false;
+	}
+	log_async_on = true;
+	return true;
+}
+
+/* wait until everything logged so far is formatted */
+void log_async_flush(void)
+{
+	size_t tail = atomic_load(&logq.tail);
+	while (atomic_load(&logq.head) < tail)
+		nanosleep(&(struct timespec) { .tv_nsec = 100000 }, NULL);
+}
+
+/* call after every other thread is done logging */
+void log_async_stop(void)
+{
+	if (!log_async_on)
+		return;
+	log_async_on = false;
+	atomic_store(&logq.stop, true);
+	pthread_join(logq.tid, NULL);
+	free(logq.ring);
+	logq.ring = NULL;
+	size_t stalls = atomic_load(&logq.stalls);
+	if (stalls)
+		log_info("Log ring was full %zu times.", stalls);
+}
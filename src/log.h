@@ -2,11 +2,13 @@
 #define LOG_H
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 
 enum log_level {
+	LOG_TRACE,
 	LOG_INFO,
 	LOG_WARN,
 	LOG_FAIL,
@@ -16,13 +18,24 @@ enum log_level {
 //#define LOG_DEBUG
 #define LOG_BUF_SIZE 8192U
 
+/* Messages below this level are compiled out, arguments and all, e.g.
+ * -DLOG_LEVEL_MIN=LOG_INFO drops the per event trace.
+ */
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN LOG_TRACE
+#endif
+
 extern char log_buf[];
+extern const char *const lev2str[_LOG_LEVEL_MAX];
+/* messages below this level are dropped at runtime */
+extern enum log_level log_threshold;
+extern bool log_async_on;
 
-static char* lev2str[_LOG_LEVEL_MAX] = {
-	[LOG_INFO] = "INFO",
-	[LOG_WARN] = "WARN",
-	[LOG_FAIL] = "FAIL",
-};
+bool log_async_start(void);
+void log_async_stop(void);
+void log_async_flush(void);
+void log_async_write(enum log_level lev, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
 
 #ifdef LOG_DEBUG
 #define log_more(lev) do {						\
@@ -35,13 +48,26 @@ static char* lev2str[_LOG_LEVEL_MAX] = {
 
 /* Use token pasting GNU extension */
 #define log_internal(lev, str, ...) do {				\
+		if ((lev) < LOG_LEVEL_MIN || (lev) < log_threshold)	\
+			break;						\
+		if (log_async_on) {					\
+			log_async_write(lev, str, ##__VA_ARGS__);	\
+			break;						\
+		}							\
 		log_more(lev);						\
 		fprintf(stderr, str "\n", ##__VA_ARGS__);		\
 	} while (0)
 
+#define log_trace(...) log_internal(LOG_TRACE, __VA_ARGS__)
 #define log_info(...) log_internal(LOG_INFO, __VA_ARGS__)
 #define log_warn(...) log_internal(LOG_WARN, __VA_ARGS__)
-#define log_error(...) do { log_internal(LOG_FAIL, __VA_ARGS__); fflush(stderr); } while (0)
+#define log_error(...) do {						\
+		log_internal(LOG_FAIL, __VA_ARGS__);			\
+		log_sync();						\
+		fflush(stderr);						\
+	} while (0)
 #define log_oom() log_error("Memory allocation failed!")
+/* before writing to stderr directly, around the log */
+#define log_sync() do { if (log_async_on) log_async_flush(); } while (0)
 
 #endif
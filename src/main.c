@@ -1,219 +1,513 @@
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#ifdef __GLIBC__
-#include <malloc.h>
-#endif
+#include <string.h>
+#include <unistd.h>
 
+#include "branch.h"
+#include "checkpoint.h"
 #include "config.h"
+#include "curve.h"
+#include "ensemble.h"
+#include "frontier.h"
 #include "prioq.h"
 #include "graph.h"
+#include "loader.h"
+#include "shard.h"
+#include "sim.h"
+#include "stats.h"
+#include "trace.h"
 #include "log.h"
 
-/* TODO:
- * Ensure that the SAMPLE_SIZE is no bigger than RAND_MAX
- * Find some comprehensive fix to UAFs from vector_reset
- */
-
 char log_buf[LOG_BUF_SIZE];
 
-// anchors for SIR lists
-List ListS;
-List ListI;
-List ListR;
-size_t max_conn = 0;
-
 #define DUMP_NUM  0x00000001
 #define DUMP_NODE 0x00000002
 #define DUMP_SIR  0x00000004
+#define DUMP_POOL 0x00000008
 
-__attribute__((noreturn)) void usage(void)
-{
-	log_error("This program takes no arguments.");
-	exit(0);
-}
-
-#ifdef __GLIBC__
-
-static void configure_malloc_behavior(void)
+__attribute__((noreturn)) void usage(int status)
 {
-	mallopt(M_TRIM_THRESHOLD, -1);
-	mallopt(M_MMAP_MAX, 0);
+	log_error("Usage: covid-sim [-n sample_size] [-e nr_edges] [-t time_max]\n"
+		  "                 [-T prob_t] [-Y prob_y] [-s seed] [-g rng]\n"
+		  "                 [-r replicates] [-j threads] [-f file]\n"
+		  "                 [-G graph] [-o output] [-b] [-x trace] [-S stats]\n"
+		  "                 [-p | -P shards] [-c checkpoint] [-k days]\n"
+		  "                 [-B day]\n"
+		  "                 [-v] [-q] [-a]\n"
+		  "                 [scenario...]\n"
+		  "\n"
+		  "Options set the defaults for every scenario. A scenario is a list\n"
+		  "of key=value pairs separated by commas, with the keys sample_size,\n"
+		  "nr_edges, time_max, prob_t, prob_y, seed, rng (philox or\n"
+		  "threefry), model, rewire and replicates. Scenarios are read one\n"
+		  "per line from file (- for stdin, # starts a comment) and from the\n"
+		  "remaining arguments, and run back to back in this process.\n"
+		  "Without any scenario, the defaults are run once.\n"
+		  "\n"
+		  "The model of the random graph is random (each other node makes\n"
+		  "up to nr_edges edges), gnm (nr_edges * sample_size / 2 edges\n"
+		  "between uniform pairs), ba (preferential attachment) or ws\n"
+		  "(a ring lattice with each edge rewired with chance rewire). For\n"
+		  "the last three, nr_edges is the mean degree.\n"
+		  "\n"
+		  "With -G, every scenario runs on the graph in the given edge list\n"
+		  "(two 0-based node ids per line) or snapshot, rather than on a\n"
+		  "random one. The parsed edge list is saved as a snapshot next to\n"
+		  "it, with the suffix " SNAPSHOT_SUFFIX ", which later runs map instead.\n"
+		  "\n"
+		  "The S, I and R counts and new infections at the end of each day\n"
+		  "are written to output (stdout by default) as CSV, or in binary\n"
+		  "with -b. A scenario with more than one replicate is run on\n"
+		  "threads (all online CPUs unless -j is given), and for it the CSV\n"
+		  "has the statistics of each day over all replicates instead.\n"
+		  "With -x, every event of the scenarios without replicates is\n"
+		  "recorded to a binary trace, read with tools/sir-trace.\n"
+		  "With -p, a scenario without replicates is simulated a day at a\n"
+		  "time on the threads, all events of a day at once. Its curve has\n"
+		  "the same distribution as with the serial engine, but events of\n"
+		  "the same day are ordered differently, so it is not the same run.\n"
+		  "It is the same for any number of threads, and is not traced.\n"
+		  "With -P, such a scenario is split into the given number of\n"
+		  "processes, each with a part of the nodes, which exchange events\n"
+		  "through shared memory at the end of each day. Likewise the same\n"
+		  "distribution but not the same run, and not traced.\n"
+		  "With -c, a single scenario is saved to checkpoint on SIGTERM or\n"
+		  "SIGINT, and every -k days if given, and resumed from it when it\n"
+		  "exists. The output of a resumed run is that of a run never\n"
+		  "stopped. The checkpoint is removed once the run is over.\n"
+		  "With -B, the first scenario runs up to day once, and every\n"
+		  "scenario, which may differ from it only in prob_t, goes on from\n"
+		  "there in a process of its own (up to -j at a time).\n"
+		  "With -S, counts of the events and queue, pool and vector activity\n"
+		  "and the time spent in each phase are written to stats as JSON\n"
+		  "at exit.\n"
+		  "With -v, every event and the full node lists are logged, with -q\n"
+		  "only warnings and errors. With -a, messages are formatted and\n"
+		  "written by a background thread.");
+	exit(status);
 }
 
-static void reserve_mem(size_t size)
+/* the argument of a numeric option, from min to max */
+static unsigned long parse_option(int opt, const char *arg, unsigned long min, unsigned long max)
 {
-	char *buf = malloc(size);
-	int pagesize = sysconf(_SC_PAGESIZE);
-	/* touch each page of memory to fault it in */
-	for (int i = 0; i < size; i += pagesize) {
-		buf[i] = 0;
+	unsigned long u;
+	if (!config_parse_ulong(arg, &u) || u < min || u > max) {
+		log_error("-%c takes a number from %lu to %lu, not %s.", opt, min, max, arg);
+		usage(1);
 	}
-	free(buf);
+	return u;
 }
 
-#endif
-
-static void dump_stats(Node *n, unsigned mask)
+static void dump_stats(Sim *s, unsigned mask)
 {
 	if (mask & DUMP_NUM) {
-		log_info("Sample Size:        %u", SAMPLE_SIZE);
-		log_info("Max edges:          %u", NR_EDGES);
-		log_info("Connections made:   %zu", max_conn);
-		log_info("Infected people:    %zu", sir_list_len(&ListI));
+		log_info("Sample Size:        %zu", s->cfg.sample_size);
+		log_info("Max edges:          %zu", s->cfg.nr_edges);
+		log_info("Connections made:   %zu", s->nr_conn);
+		log_info("Infected people:    %zu", node_store_count(&s->nodes, SIR_INFECTED));
+	}
+	if (mask & DUMP_POOL) {
+		log_info("Events allocated:   %zu", s->pq->pool.nr_alloc);
+		log_info("Events released:    %zu", s->pq->pool.nr_release);
+		log_info("Events peak in use: %zu", s->pq->pool.max_live);
+		log_info("Event slabs:        %zu", s->pq->pool.nr_slabs);
+		log_info("Event arena bytes:  %zu", s->pq->pool.arena.mapped);
 	}
 	if (mask & DUMP_SIR) {
-		log_info("Susceptible: "); sir_list_dump(&ListS);
-		log_info("Infected: "); sir_list_dump(&ListI);
-		log_info("Recovered: "); sir_list_dump(&ListR);
+		log_info("Susceptible: "); node_store_dump(&s->nodes, SIR_SUSCEPTIBLE);
+		log_info("Infected: "); node_store_dump(&s->nodes, SIR_INFECTED);
+		log_info("Recovered: "); node_store_dump(&s->nodes, SIR_RECOVERED);
 	}
 	if (mask & DUMP_NODE) {
-		assert(n);
-		for (size_t i = 0; i < SAMPLE_SIZE; i++)
-			node_dump_adjacent_nodes(n + i);
+		for (size_t i = 0; i < s->g->nr_nodes; i++)
+			graph_dump_adjacent_nodes(s->g, i);
 	}
 	log_info("================================");
 }
 
-int main(int argc, char *argv[])
+/* where the results of the runs go */
+struct output {
+	CurveWriter curve;
+	/* opened with -x only */
+	Trace trace;
+	bool tracing;
+	bool verbose;
+};
+
+/* how a scenario without replicates is simulated, through the queue
+   when neither is set */
+struct engine {
+	/* -p */
+	Frontier *days;
+	/* -P */
+	unsigned int nr_shards;
+	/* -c and -k, with the queue only */
+	const char *checkpoint;
+	size_t checkpoint_every;
+};
+
+static volatile sig_atomic_t halted;
+
+static void on_halt(int sig)
 {
-	PriorityQueue *pq = NULL;
-	Node *narr = NULL;
-	int r;
+	(void) sig;
+	halted = 1;
+}
 
-	if (NR_EDGES > SAMPLE_SIZE - 1) {
-		log_error("Incorrect NR_EDGES value configured.");
-		return 1;
-	}
-#ifdef __GLIBC__
-	if (SAMPLE_SIZE > 100) {
-		configure_malloc_behavior();
-		reserve_mem(512*1024*1024);
+/* Saves the run every checkpoint_every days, and stops it at the start
+ * of the next day on SIGTERM or SIGINT, saved.
+ */
+static bool simulate_checkpointed(Sim *s, const struct engine *eng)
+{
+	s->halt = &halted;
+	for (;;) {
+		s->halt_day = eng->checkpoint_every ? s->day + eng->checkpoint_every : SIZE_MAX;
+		if (sim_simulate(s))
+			break;
+		if (!checkpoint_write(s, eng->checkpoint))
+			return false;
+		if (halted) {
+			log_warn("Stopped at day %zu, run again to resume from %s.", s->day, eng->checkpoint);
+			return false;
+		}
 	}
-#endif
-
-	srand(0x0bad1dea);
-	if (argc > 1)
-		usage();
+	/* over, so the next run starts afresh */
+	if (unlink(eng->checkpoint) < 0 && errno != ENOENT)
+		log_warn("Failed to remove checkpoint %s: %s", eng->checkpoint, strerror(errno));
+	return true;
+}
 
-	r = setvbuf(stderr, log_buf, _IOFBF, LOG_BUF_SIZE);
-	if (r < 0)
-		log_warn("Failed to set up log buffer.");
+/* each shard seeds its own part */
+static bool run_shards(Sim *s, unsigned int nr_shards, CurveWriter *w, bool verbose)
+{
+	ShardPlan plan;
 
-	pq = pq_new();
-	if (!pq) {
-		log_error("Failed to setup priority queue, fatal.");
+	if (nr_shards > s->g->nr_nodes)
+		nr_shards = s->g->nr_nodes;
+	if (!shard_partition(&plan, s->g, nr_shards)) {
 		log_oom();
-		goto finish;
+		return false;
 	}
+	log_info("Edges between shards: %zu of %zu", plan.cut, s->g->nr_edges);
+	stats_phase(PHASE_SIMULATE);
+	s->out = w;
+	bool ok = shard_simulate(&plan, s);
+	s->out = NULL;
+	shard_plan_release(&plan);
+	if (!ok)
+		return false;
+	stats_phase(PHASE_REPORT);
+	dump_stats(s, DUMP_NUM | (verbose ? DUMP_SIR|DUMP_NODE : 0));
+	return true;
+}
 
-	narr = node_new(SAMPLE_SIZE);
-	if (!narr) {
-		log_error("Failed to allocate nodes, fatal.");
-		log_oom();
-		goto finish;
+/* net is the graph loaded with -G, or NULL to generate one per scenario */
+static bool run(Sim *s, Ensemble *e, const struct engine *eng, struct output *o, Graph *net,
+		const Config *cfg, size_t scenario)
+{
+	CurveWriter *w = &o->curve;
+	bool single = cfg->replicates == 1;
+	bool verbose = o->verbose && single;
+
+	stats_phase(PHASE_ALLOC);
+	if (!sim_reset(s, cfg))
+		goto oom;
+	if (verbose) {
+		log_info("Initial lists: ");
+		dump_stats(s, DUMP_SIR);
+	}
+	stats_phase(PHASE_GRAPH);
+	if (net) {
+		sim_share_graph(s, net);
+		s->nr_conn = net->nr_edges;
+	} else if (!sim_generate(s, e->nr_threads))
+		goto oom;
+	if (!single) {
+		/* each replicate seeds and simulates on the graph made here */
+		if (o->tracing)
+			log_warn("Scenarios with replicates are not traced.");
+		/* seeding included */
+		stats_phase(PHASE_SIMULATE);
+		if (!ensemble_run(e, cfg, s->g))
+			return false;
+		stats_phase(PHASE_REPORT);
+		log_info("Connections made:   %zu", s->nr_conn);
+		log_info("Replicates:         %zu", cfg->replicates);
+		if (w->fmt == CURVE_CSV)
+			ensemble_dump(e, w);
+		else
+			ensemble_write(e, w);
+		return true;
+	}
+	if (verbose) {
+		log_info("Node connections: ");
+		dump_stats(s, DUMP_NODE);
 	}
+	if (o->tracing && (eng->days || eng->nr_shards))
+		log_warn("Scenarios simulated by day or in shards are not traced.");
+	else if (o->tracing) {
+		trace_begin(&o->trace, scenario, cfg->sample_size, cfg->time_max);
+		s->trace = &o->trace;
+	}
+	if (eng->nr_shards)
+		return run_shards(s, eng->nr_shards, w, verbose);
+	stats_phase(PHASE_SEED);
+	if (eng->checkpoint && !access(eng->checkpoint, F_OK)) {
+		if (!checkpoint_restore(s, eng->checkpoint))
+			return false;
+		log_info("Resuming from %s at day %zu.", eng->checkpoint, s->day);
+		/* the days before were written by the run that stopped, but
+		   to an output started over */
+		for (size_t d = 0; d < s->day; d++)
+			curve_write(w, s->rng.key[1], d, s->curve + d);
+	} else if (!sim_seed(s))
+		goto oom;
+	/* the curve goes out day by day */
+	stats_phase(PHASE_SIMULATE);
+	s->out = w;
+	bool ok = true;
+	if (eng->days)
+		ok = frontier_simulate(eng->days, s);
+	else if (eng->checkpoint)
+		ok = simulate_checkpointed(s, eng);
+	else
+		sim_simulate(s);
+	s->out = NULL;
+	s->trace = NULL;
+	if (!ok)
+		return false;
+	stats_phase(PHASE_REPORT);
+	dump_stats(s, DUMP_NUM|DUMP_POOL | (verbose ? DUMP_SIR|DUMP_NODE : 0));
+	return true;
+oom:
+	log_oom();
+	return false;
+}
 
-	for (size_t i = 0; i < SAMPLE_SIZE; i++) {
-		if (!sir_list_add_item(narr + i, &ListS)) {
-			log_error("Failed to add nodes to Susceptible list, fatal.");
-			log_oom();
-			goto finish;
+/* the scenarios of list as branches of the first, see branch.h */
+static bool run_branches(Sim *s, struct output *o, Graph *net, const Config *list, size_t nr,
+			 size_t day, unsigned int nr_procs)
+{
+	stats_phase(PHASE_ALLOC);
+	if (!sim_reset(s, list))
+		goto oom;
+	stats_phase(PHASE_GRAPH);
+	if (net) {
+		sim_share_graph(s, net);
+		s->nr_conn = net->nr_edges;
+	} else if (!sim_generate(s, nr_procs))
+		goto oom;
+	stats_phase(PHASE_SEED);
+	if (!sim_seed(s))
+		goto oom;
+	stats_phase(PHASE_SIMULATE);
+	if (!branch_run(s, list, nr, day, nr_procs, &o->curve))
+		return false;
+	stats_phase(PHASE_REPORT);
+	log_info("Connections made:   %zu", s->nr_conn);
+	log_info("Branches:           %zu", nr);
+	return true;
+oom:
+	log_oom();
+	return false;
+}
+
+/* append the scenarios in f, one per line, to list */
+static bool read_scenarios(FILE *f, const Config *base, Vector *list)
+{
+	char *line = NULL;
+	size_t len = 0;
+	bool ret = true;
+	while (getline(&line, &len, f) >= 0) {
+		char *c = strchr(line, '#');
+		if (c) *c = '\0';
+		if (!line[strspn(line, " \t\n,")]) continue;
+		Config cfg = *base;
+		if (!config_parse(&cfg, line) || vector_push_back(list, &cfg) < 0) {
+			ret = false;
+			break;
 		}
 	}
+	free(line);
+	return ret;
+}
 
-	log_info("Initial lists: ");
-	dump_stats(NULL, DUMP_SIR);
+int main(int argc, char *argv[])
+{
+	Sim s = {};
+	Ensemble e = {};
+	Frontier days = {};
+	struct engine eng = {};
+	Config base;
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	Vector *list = NULL;
+	const char *file = NULL, *output = "-", *trace = NULL, *graph = NULL, *report = NULL;
+	Graph net = {};
+	struct output o = { .trace.fd = -1 };
+	CurveFormat fmt = CURVE_CSV;
+	bool async = false, by_day = false;
+	long branch_day = -1;
+	int r = 1, opt;
 
-	// now connect nodes, randomly
-	for (size_t i = 0; i < SAMPLE_SIZE; i += 2) {
-		int c = 0;
-		c = gen_random_id(NR_EDGES+1, -1);
-		while (c--) {
-			size_t j = gen_random_id(SAMPLE_SIZE, i);
-			node_connect(&narr[i], &narr[j]);
+	config_default(&base);
+	while ((opt = getopt(argc, argv, "n:e:t:T:Y:s:g:r:j:f:o:x:G:S:P:c:k:B:bpvqah")) != -1) {
+		const char *key = NULL;
+		switch (opt) {
+		case 'n': key = "sample_size"; break;
+		case 'e': key = "nr_edges"; break;
+		case 't': key = "time_max"; break;
+		case 'T': key = "prob_t"; break;
+		case 'Y': key = "prob_y"; break;
+		case 's': key = "seed"; break;
+		case 'g': key = "rng"; break;
+		case 'r': key = "replicates"; break;
+		case 'j': nr_threads = parse_option(opt, optarg, 1, UINT_MAX); break;
+		case 'f': file = optarg; break;
+		case 'o': output = optarg; break;
+		case 'b': fmt = CURVE_BINARY; break;
+		case 'x': trace = optarg; break;
+		case 'G': graph = optarg; break;
+		case 'S': report = optarg; break;
+		case 'p': by_day = true; break;
+		case 'P': eng.nr_shards = parse_option(opt, optarg, 1, UINT_MAX); break;
+		case 'c': eng.checkpoint = optarg; break;
+		case 'k': eng.checkpoint_every = parse_option(opt, optarg, 1, SIZE_MAX); break;
+		case 'B': branch_day = parse_option(opt, optarg, 0, LONG_MAX); break;
+		case 'v': o.verbose = true; log_threshold = LOG_TRACE; break;
+		case 'q': log_threshold = LOG_WARN; break;
+		case 'a': async = true; break;
+		case 'h': usage(0);
+		default: usage(1);
 		}
+		if (key && !config_set(&base, key, optarg))
+			usage(1);
+	}
+
+	/* before anything is logged */
+	if (setvbuf(stderr, log_buf, _IOFBF, LOG_BUF_SIZE) < 0)
+		log_warn("Failed to set up log buffer.");
+	if (async && !log_async_start())
+		log_warn("Failed to start the log thread, logging synchronously.");
+	if (nr_threads < 1)
+		nr_threads = 1;
+	if (by_day && eng.nr_shards) {
+		log_error("-p and -P do not go together.");
+		usage(1);
 	}
-	log_info("Node connections: ");
-	dump_stats(narr, DUMP_NODE);
 
-	size_t infect = gen_random_id(SAMPLE_SIZE, 0);
-	while (infect--) {
-		size_t r = gen_random_id(SAMPLE_SIZE, -1);
-		if (narr[r].initial == true) {
-			continue;
+	list = vector_new(sizeof(Config));
+	if (!list) {
+		log_oom();
+		return 1;
+	}
+	/* the graph fixes the sample size of every scenario */
+	if (graph) {
+		stats_phase(PHASE_GRAPH);
+		if (!graph_load(&net, graph, nr_threads))
+			goto finish;
+		log_info("Loaded %s: %zu nodes, %zu edges.", graph, net.nr_nodes, net.nr_edges);
+		base.sample_size = net.nr_nodes;
+		if (base.nr_edges > net.nr_nodes - 1)
+			base.nr_edges = net.nr_nodes - 1;
+	}
+	if (file) {
+		FILE *f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+		if (!f) {
+			log_error("Failed to open scenario file %s.", file);
+			goto finish;
 		}
-		PQEvent *ev = pqevent_new(narr + r, TRANSMIT);
-		if (!ev) {
-			log_warn("Failed to allocate TRANSMIT event for spreader %u.", narr[r].id);
-			log_oom();
-			continue;
+		bool ok = read_scenarios(f, &base, list);
+		if (f != stdin) fclose(f);
+		if (!ok) goto finish;
+	}
+	for (int i = optind; i < argc; i++) {
+		Config cfg = base;
+		if (!config_parse(&cfg, argv[i]) || vector_push_back(list, &cfg) < 0)
+			goto finish;
+	}
+	if (!list->length && vector_push_back(list, &base) < 0)
+		goto finish;
+
+	Config *sc = (Config *) list->p;
+	for (size_t i = 0; i < list->length; i++) {
+		if (!config_check(sc + i))
+			goto finish;
+		if (graph && sc[i].sample_size != net.nr_nodes) {
+			log_error("sample_size must be %zu, the nodes of %s.", net.nr_nodes, graph);
+			goto finish;
 		}
-		ev->timestamp = 0;
-		if (!pqevent_add(pq, ev)) {
-			log_warn("Failed to add TRANSMIT event for spreader %u.", narr[r].id);
-			pqevent_delete(ev);
-			continue;
+	}
+
+	if (branch_day >= 0) {
+		if (by_day || eng.nr_shards || eng.checkpoint) {
+			log_error("-B goes with none of -p, -P and -c.");
+			goto finish;
 		}
-		log_info("Added TRANSMIT event for initial spreader %u with time %lu", narr[r].id, ev->timestamp);
-		ev = pqevent_new(narr + r, RECOVER);
-		if (!ev) {
-			log_warn("Failed to allocate RECOVER event for spreader %u.", narr[r].id);
-			log_oom();
-			continue;
+		if (!branch_check(sc, list->length, branch_day))
+			goto finish;
+		if (trace)
+			log_warn("Branched scenarios are not traced.");
+	}
+	if (eng.checkpoint) {
+		if (list->length > 1 || sc->replicates > 1 || by_day || eng.nr_shards) {
+			log_error("-c takes one scenario without replicates, through the queue.");
+			goto finish;
 		}
-		ev->timestamp = toss_coin(0, ev->Y) + 12;
-		if (!pqevent_add(pq, ev)) {
-			log_warn("Failed to add RECOVER event for spreader %u.", narr[r].id);
-			pqevent_delete(ev);
-			continue;
+		struct sigaction sa = { .sa_handler = on_halt, .sa_flags = SA_RESTART };
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGTERM, &sa, NULL);
+		sigaction(SIGINT, &sa, NULL);
+	}
+
+	stats_phase(PHASE_ALLOC);
+
+	if (!curve_writer_open(&o.curve, output, fmt))
+		goto finish;
+	if (trace && !(o.tracing = trace_open(&o.trace, trace)))
+		goto finish;
+	if (!sim_init(&s, sc) || !ensemble_init(&e, nr_threads) ||
+	    (by_day && !frontier_init(&days, nr_threads))) {
+		log_oom();
+		goto finish;
+	}
+	if (by_day)
+		eng.days = &days;
+	if (branch_day >= 0 &&
+	    !run_branches(&s, &o, graph ? &net : NULL, sc, list->length, branch_day, nr_threads))
+		goto finish;
+	for (size_t i = 0; branch_day < 0 && i < list->length; i++) {
+		if (list->length > 1) {
+			log_info("Scenario %zu of %zu: ", i + 1, list->length);
+			config_dump(sc + i);
 		}
-		log_info("Added RECOVER event for initial spreader %u with time %lu", narr[r].id, ev->timestamp);
-		narr[r].initial = true;
-	}
-
-	// begin simulation
-	PQEvent *ev;
-	for (ev = pqevent_next(pq); ev && ev->timestamp < TIME_MAX; ev = pqevent_next(pq)) {
-		if (ev->type == TRANSMIT) {
-			if (UINT_IN_SET(ev->node->state, SIR_SUSCEPTIBLE, SIR_RECOVERED) ||
-				(ev->timestamp == 0 && ev->node->state == SIR_INFECTED)) {
-				log_info("Processing event TRANSMIT at time %lu for Node %u", ev->timestamp, ev->node->id);
-				process_trans_SIR(pq, ev);
-			}
-		} else if (ev->type == RECOVER && ev->node->state != SIR_RECOVERED) {
-			log_info("Processing event RECOVER at time %lu for Node %u", ev->timestamp, ev->node->id);
-			process_rec_SIR(pq, ev);
-		} /* else skip the event */
-		pqevent_delete(ev);
-	}
-	if (ev) {
-		/* min-heap was not empty */
-		/* caught by LSAN: this is a min heap, so a zero
-		initialized PQEvent is not really a good end marker,
-		since it would swap its way up to the top, and cut
-		short our loop below, leaking memory, hence make the
-		timestamp infinite */
-		pqevent_add(pq, &(PQEvent){ .timestamp = -1 });
-		do {
-			pqevent_delete(ev);
-		} while (ev = pqevent_next(pq), ev && ev->node);
-	}
-	dump_stats(narr, DUMP_SIR|DUMP_NUM|DUMP_NODE);
+		curve_begin(&o.curve, i);
+		if (!run(&s, &e, &eng, &o, graph ? &net : NULL, sc + i, i))
+			goto finish;
+	}
+	r = 0;
 finish:
-// Not useful with pool based SIR nodes
-/*	sir_list_del_rec(&ListS);
-	sir_list_del_rec(&ListI);
-	sir_list_del_rec(&ListR);
-	if (narr)
-		for (size_t i = 0; i < SAMPLE_SIZE; i++)
-			sir_list_del_rec(&narr[i].neigh);
-*/
+	stats_phase(PHASE_REPORT);
+	if (!curve_writer_close(&o.curve))
+		r = 1;
+	if (o.tracing && !trace_close(&o.trace))
+		r = 1;
+	stats_collect(&s.stats);
+	if (e.workers)
+		ensemble_collect_stats(&e);
+	if (report && !stats_report(report))
+		r = 1;
 	log_info("Destructing objects...");
-	// resets pool
-	sir_list_add_item(NULL, NULL);
-	free(narr);
-	pq_delete(pq);
+	sim_release(&s);
+	ensemble_release(&e);
+	frontier_release(&days);
+	vector_reset(list);
+	free(list);
+	graph_release(&net);
+	log_async_stop();
 	return r;
 }
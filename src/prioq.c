@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "config.h"
 #include "graph.h"
@@ -7,212 +9,340 @@
 #include "vector.h"
 #include "log.h"
 
-PriorityQueue* pq_new(void)
+PriorityQueue* pq_new(PQBackend backend, const Config *cfg)
 {
-	PriorityQueue *pq = malloc(sizeof *pq);
+	assert(backend < _PQ_BACKEND_MAX);
+	PriorityQueue *pq = calloc(1, sizeof *pq);
 	if (!pq) return NULL;
-	pq->vec = vector_new(sizeof(PQEvent*));
-	/* caught by cppcheck */
-	if (!pq->vec) { free(pq); return NULL; }
-	pq->events = (PQEvent **) pq->vec->p;
+	pq->backend = backend;
+	if (backend == PQ_HEAP) {
+		/* padding in front of the root */
+		struct pq_entry pad[PQ_HEAP_ROOT] = {};
+		if (pq_entries_append(&pq->entries, pad, PQ_HEAP_ROOT) < 0) {
+			pq_delete(pq);
+			return NULL;
+		}
+	}
+	if (!pq_reset(pq, cfg)) {
+		pq_delete(pq);
+		return NULL;
+	}
 	return pq;
 }
 
+bool pq_reset(PriorityQueue *pq, const Config *cfg)
+{
+	assert(pq);
+	assert(cfg);
+	pq->cfg = cfg;
+	pq->length = 0;
+	pq->seq = 0;
+	if (pq->backend == PQ_CALENDAR) {
+		/* days 0 to horizon, plus the overflow bucket */
+		size_t nr = cfg->time_max + 2;
+		if (nr > pq->nr_buckets) {
+			struct pq_bucket *b = reallocarray(pq->buckets, nr, sizeof *b);
+			if (!b) return false;
+			pq->buckets = b;
+		}
+		pq->nr_buckets = nr;
+		memset(pq->buckets, 0, nr * sizeof *pq->buckets);
+		pq->cursor = 0;
+	} else {
+		pq->entries.length = PQ_HEAP_ROOT;
+	}
+	/* whatever was still queued goes back to the free list, the slabs
+	   themselves are kept for the next run */
+	struct pqevent_pool *pool = &pq->pool;
+	if (!pool->slabs) {
+		/* room for a TRANSMIT and a RECOVER per node, the most
+		   there can be, but only touched as the run needs it */
+		size_t nr = (2 * cfg->sample_size + PQEVENT_SLAB_NR - 1) / PQEVENT_SLAB_NR;
+		arena_init(&pool->arena, (nr ? nr : 1) * (sizeof(struct pqevent_slab) + ARENA_ALIGN));
+	}
+	pool->free = NULL;
+	for (struct pqevent_slab *s = pool->slabs; s; s = s->next) {
+		for (size_t i = PQEVENT_SLAB_NR; i--;) {
+			s->events[i].next = pool->free;
+			pool->free = &s->events[i];
+		}
+	}
+	pool->nr_alloc = pool->nr_release = pool->max_live = 0;
+	return true;
+}
+
 void pq_delete(PriorityQueue *pq)
 {
+	if (!pq) return;
+	/* events still queued live in the slabs, so they go in one sweep */
+	arena_release(&pq->pool.arena);
 	/* free! free! free! */
-	free(pq->vec->p);
-	free(pq->vec);
+	pq_entries_release(&pq->entries);
+	free(pq->buckets);
 	free(pq);
 }
 
-PQEvent* pqevent_new(Node *node, EventType type)
+static bool pqevent_pool_grow(struct pqevent_pool *pool)
+{
+	struct pqevent_slab *s = arena_alloc(&pool->arena, sizeof *s);
+	if (!s) return false;
+	s->next = pool->slabs;
+	pool->slabs = s;
+	pool->nr_slabs++;
+	/* thread the free list in address order, so fresh events are
+	   handed out sequentially */
+	for (size_t i = 0; i < PQEVENT_SLAB_NR - 1; i++)
+		s->events[i].next = &s->events[i + 1];
+	s->events[PQEVENT_SLAB_NR - 1].next = pool->free;
+	pool->free = s->events;
+	return true;
+}
+
+PQEvent* pqevent_new(PriorityQueue *pq, size_t node, EventType type)
 {
-	assert(node);
+	assert(pq);
 	assert(type < _EVENT_TYPE_MAX);
-	PQEvent *ev = malloc(sizeof *ev);
-	if (!ev) return NULL;
+	struct pqevent_pool *pool = &pq->pool;
+	if (!pool->free && !pqevent_pool_grow(pool)) return NULL;
+	PQEvent *ev = pool->free;
+	pool->free = ev->next;
+	ev->next = NULL;
+	pool->nr_alloc++;
+	if (pool->nr_alloc - pool->nr_release > pool->max_live)
+		pool->max_live = pool->nr_alloc - pool->nr_release;
 	ev->type = type;
+	ev->cause = 0;
 	ev->node = node;
 	if (type == TRANSMIT)
-		ev->T = PROB_T;
+		ev->T = pq->cfg->prob_t;
 	else if (type == RECOVER)
-		ev->Y = PROB_Y;
+		ev->Y = pq->cfg->prob_y;
 	else /* not reached */
 		assert(false);
 	return ev;
 }
 
-static void swap(PQEvent **a, PQEvent **b)
+static uint64_t pq_key(PriorityQueue *pq, PQEvent *ev)
 {
-	PQEvent *temp = *a;
-	*a = *b;
-	*b = temp;
+	/* timestamps past what the key can hold are beyond any horizon
+	   config_check() lets through, their order no longer matters */
+	uint64_t ts = ev->timestamp < PQ_TS_MAX ? ev->timestamp : PQ_TS_MAX;
+	return ts << PQ_SEQ_BITS | (pq->seq++ & PQ_SEQ_MASK);
 }
 
-static void pq_heapify(PriorityQueue *pq, size_t i, bool down)
+static inline void pq_place(struct pq_entry *h, size_t i, struct pq_entry e)
 {
-	/* min heap */
-	size_t lim = pq->vec->length;
-	if (i >= lim) return;
-	if (down) {
-		size_t left = i * 2 + 1;
-		size_t right = i * 2 + 2;
-		size_t smaller = i;
-		if (left < lim && pq->events[smaller]->timestamp > pq->events[left]->timestamp)
-			smaller = left;
-		if (right < lim && pq->events[smaller]->timestamp > pq->events[right]->timestamp)
-			smaller = right;
-		if (smaller != i) {
-			swap(&pq->events[i], &pq->events[smaller]);
-			pq_heapify(pq, smaller, true);
-		}
-	} else {
-		/* if i % 2 is true then left child */
-		if (i == 0) return;
-		size_t parent = (i % 2) ? (i - 1)/2 : (i - 2)/2;
-		if (pq->events[i]->timestamp < pq->events[parent]->timestamp) {
-			swap(&pq->events[i], &pq->events[parent]);
-			pq_heapify(pq, parent, false);
-		}
-	}
+	h[i] = e;
+	e.ev->slot = i;
 }
 
-bool pqevent_add(PriorityQueue *pq, PQEvent *ev)
+static void pq_sift_up(PriorityQueue *pq, size_t i)
 {
-	assert(pq);
-	assert(ev);
-	int r = vector_push_back(pq->vec, &ev);
-	if (r < 0) {
-		log_error("Failed to grow vector.");
-		return false;
+	struct pq_entry *h = pq_heap(pq), e = h[i];
+	while (i) {
+		size_t parent = (i - 1) / PQ_HEAP_ARITY;
+		if (h[parent].key <= e.key)
+			break;
+		pq_place(h, i, h[parent]);
+		i = parent;
 	}
-	/* caught by ASAN: possibly resized/reinitialized, so replace
-	   with new address. This can also happen during normal growth */
-	pq->events = (PQEvent **) pq->vec->p;
-	pq_heapify(pq, pq->vec->length - 1, false);
-	return true;
+	pq_place(h, i, e);
 }
 
-static bool pq_pop_front(PriorityQueue *pq)
+static void pq_sift_down(PriorityQueue *pq, size_t i)
 {
-	static int i = 0;
-	if (!pq->vec->length) return false;
-	pq->events[0] = pq->events[pq->vec->length - 1];
-	vector_pop_back(pq->vec);
-	pq->events = (PQEvent **) pq->vec->p;
-	pq_heapify(pq, 0, true);
-	i++;
-	/* XXX: add vec_is_empty primitive, vector might have been reset */
-	if (i > 7 && pq->vec->length) {
-		vector_shrink_to_fit(pq->vec);
-		pq->events = (PQEvent **) pq->vec->p;
-		i = 0;
+	/* min heap */
+	struct pq_entry *h = pq_heap(pq), e = h[i];
+	size_t lim = pq->length;
+	for (;;) {
+		size_t c = i * PQ_HEAP_ARITY + 1, end = c + PQ_HEAP_ARITY;
+		if (c >= lim)
+			break;
+		if (end > lim)
+			end = lim;
+		/* siblings share a cache line, scan them all */
+		size_t smaller = c;
+		for (c++; c < end; c++)
+			if (h[c].key < h[smaller].key)
+				smaller = c;
+		if (e.key <= h[smaller].key)
+			break;
+		pq_place(h, i, h[smaller]);
+		i = smaller;
 	}
-	return true;
+	pq_place(h, i, e);
 }
 
-PQEvent* pqevent_next(PriorityQueue *pq)
+static size_t pq_bucket_of(PriorityQueue *pq, unsigned long timestamp)
 {
-	assert(pq);
-	PQEvent *r = pq->events ? pq->events[0] : NULL;
-	if (!pq_pop_front(pq)) return NULL;
-	return r;
+	size_t last = pq->nr_buckets - 1;
+	return timestamp < last ? timestamp : last;
 }
 
-size_t gen_random_id(size_t b, size_t except)
+static void pq_calendar_add(PriorityQueue *pq, PQEvent *ev)
 {
-	assert(b);
-	assert(except < b || except == (size_t) -1);
-	size_t r;
-	if (b == 1) return 0;
-	r = rand() % b;
-	return r == except ? (except ? r - 1 : r + 1) : r;
+	size_t i = pq_bucket_of(pq, ev->timestamp);
+	struct pq_bucket *b = &pq->buckets[i];
+	ev->next = NULL;
+	ev->prev = b->tail;
+	if (b->tail) b->tail->next = ev;
+	else b->head = ev;
+	b->tail = ev;
+	/* an event may be scheduled before the day currently being
+	   drained, move back so it still comes out first */
+	if (i < pq->cursor) pq->cursor = i;
+	pq->length++;
 }
 
-static bool get_heads(double bias)
+static void pq_calendar_unlink(PriorityQueue *pq, struct pq_bucket *b, PQEvent *ev)
 {
-	assert(bias <= 1.0);
-	int i = bias * 1000;
-	if (gen_random_id(1001, i) < i) return true;
-	return false;
+	if (ev->prev) ev->prev->next = ev->next;
+	else b->head = ev->next;
+	if (ev->next) ev->next->prev = ev->prev;
+	else b->tail = ev->prev;
+	ev->next = ev->prev = NULL;
+	pq->length--;
 }
 
-size_t toss_coin(size_t ts, double bias)
+/* earliest event, left in place; the cursor is at its bucket */
+static PQEvent* pq_calendar_first(PriorityQueue *pq)
 {
-	assert(bias <= 1.0);
-	size_t t = 0;
-	while (++t <= TIME_MAX - ts) {
-		if (get_heads(bias))
-			break;
+	size_t last = pq->nr_buckets - 1;
+	if (!pq->length) return NULL;
+	while (!pq->buckets[pq->cursor].head)
+		pq->cursor++;
+	struct pq_bucket *b = &pq->buckets[pq->cursor];
+	PQEvent *ev = b->head;
+	if (pq->cursor == last) {
+		/* overflow bucket is unordered, take the earliest; the
+		   strict compare keeps FIFO order among equal timestamps */
+		for (PQEvent *i = b->head; i; i = i->next)
+			if (i->timestamp < ev->timestamp)
+				ev = i;
 	}
-	return ts + t + 1 < TIME_MAX - 12 ? ts + t + 1 : TIME_MAX - 12 ;
+	return ev;
 }
 
-void process_trans_SIR(PriorityQueue *pq, PQEvent *ev)
+static PQEvent* pq_calendar_next(PriorityQueue *pq)
+{
+	PQEvent *ev = pq_calendar_first(pq);
+	if (ev)
+		pq_calendar_unlink(pq, &pq->buckets[pq->cursor], ev);
+	return ev;
+}
+
+bool pqevent_add(PriorityQueue *pq, PQEvent *ev)
 {
 	assert(pq);
 	assert(ev);
-	Node *n = ev->node;
-	struct sir *s = NULL;
-	/* If node is already infected, don't process this TRANSMIT
-	   event for it. Same for recovered. */
-	if (UINT_IN_SET(ev->node->state, SIR_SUSCEPTIBLE)) {
-		s = sir_list_del_item(ev->node, &ListS);
-		sir_list_add_sir(s, &ListI);
-		s->item->state = SIR_INFECTED;
-	} else return;
-	/* for each neighbour */
-	list_for_each_entry(s, n->neigh.next, struct sir, list) {
-		/* add transmit event */
-		Node *n = s->item;
-		if (n->state == SIR_INFECTED) continue;
-		PQEvent *r = NULL, *t = pqevent_new(n, TRANSMIT);
-		if (!t) {
-			log_error("Failed to create TRANSMIT event for Node %u", n->id);
-			log_oom();
-			continue;
-		}
-		t->timestamp = toss_coin(ev->timestamp, ev->T);
-		ev->timestamp += t->timestamp - ev->timestamp;
-		if (!pqevent_add(pq, t)) {
-			log_error("Failed to add TRANSMIT event for Node %u", n->id);
-			goto finish;
-		}
-		log_info("Added TRANSMIT event for Node %u with time %lu", n->id, t->timestamp);
+	if (pq->backend == PQ_CALENDAR) {
+		pq_calendar_add(pq, ev);
+		return true;
+	}
+	struct pq_entry e = { .key = pq_key(pq, ev), .ev = ev };
+	if (pq_entries_push(&pq->entries, e) < 0) {
+		log_error("Failed to grow vector.");
+		return false;
+	}
+	pq_sift_up(pq, pq->length++);
+	return true;
+}
 
-		r = pqevent_new(n, RECOVER);
-		if (!r) {
-			log_error("Failed to create RECOVER event for Node %u", n->id);
-			log_oom();
-			goto finish;
-		}
-		/* can only recover after being detected as infected */
-		r->timestamp = toss_coin(ev->timestamp, ev->Y) + 12;
-		if (!pqevent_add(pq, r)) {
-			log_error("Failed to add RECOVER event for Node %u", n->id);
-			goto finish;
-		}
-		log_info("Added RECOVER event for Node %u with time %lu", n->id, r->timestamp);
-		continue;
-	finish:
-		pqevent_delete(t);
-		pqevent_delete(r);
+bool pqevent_add_many(PriorityQueue *pq, PQEvent **evs, size_t n)
+{
+	assert(pq);
+	assert(evs || !n);
+	if (pq->backend == PQ_CALENDAR) {
+		for (size_t i = 0; i < n; i++)
+			pq_calendar_add(pq, evs[i]);
+		return true;
+	}
+	size_t old = pq->length;
+	if (pq_entries_reserve(&pq->entries, PQ_HEAP_ROOT + old + n) < 0) {
+		log_error("Failed to grow vector.");
+		return false;
+	}
+	/* append, heap order is restored afterwards */
+	struct pq_entry *h = pq_heap(pq);
+	for (size_t i = 0; i < n; i++) {
+		h[old + i] = (struct pq_entry) { .key = pq_key(pq, evs[i]), .ev = evs[i] };
+		/* entries that do not move keep this slot */
+		evs[i]->slot = old + i;
 	}
+	pq->entries.length += n;
+	pq->length += n;
+	if (n < old) {
+		/* a few additions to a big heap, sifting each up is cheaper */
+		for (size_t i = old; i < pq->length; i++)
+			pq_sift_up(pq, i);
+	} else if (pq->length > 1) {
+		/* bottom-up build, O(n) */
+		for (size_t i = (pq->length - 2) / PQ_HEAP_ARITY + 1; i--;)
+			pq_sift_down(pq, i);
+	}
+	return true;
+}
+
+static bool pq_pop_front(PriorityQueue *pq)
+{
+	if (!pq->length) return false;
+	struct pq_entry *h = pq_heap(pq);
+	pq_place(h, 0, h[--pq->length]);
+	/* may shrink the buffer, but only well past the point where it
+	   last grew, see struct vector_policy */
+	pq_entries_pop(&pq->entries);
+	pq_sift_down(pq, 0);
+	return true;
 }
 
-void process_rec_SIR(PriorityQueue *pq, PQEvent *ev)
+/* Move a queued event to another time, as if it had been taken out
+ * and added again.
+ */
+void pqevent_update(PriorityQueue *pq, PQEvent *ev, unsigned long timestamp)
 {
+	assert(pq);
 	assert(ev);
-	struct sir *s = NULL;
-	if (UINT_IN_SET(ev->node->state, SIR_SUSCEPTIBLE, SIR_INFECTED)) {
-		s = sir_list_del_item(ev->node, ev->node->state == SIR_SUSCEPTIBLE ? &ListS : &ListI);
-		sir_list_add_sir(s, &ListR);
-		s->item->state = SIR_RECOVERED;
+	if (pq->backend == PQ_CALENDAR) {
+		pq_calendar_unlink(pq, &pq->buckets[pq_bucket_of(pq, ev->timestamp)], ev);
+		ev->timestamp = timestamp;
+		pq_calendar_add(pq, ev);
+		return;
 	}
+	struct pq_entry *h = pq_heap(pq);
+	assert(ev->slot < pq->length && h[ev->slot].ev == ev);
+	uint64_t old = h[ev->slot].key;
+	ev->timestamp = timestamp;
+	h[ev->slot].key = pq_key(pq, ev);
+	if (h[ev->slot].key < old)
+		pq_sift_up(pq, ev->slot);
+	else
+		pq_sift_down(pq, ev->slot);
+}
+
+/* the event pqevent_next() would return, still queued */
+PQEvent* pqevent_peek(PriorityQueue *pq)
+{
+	assert(pq);
+	if (pq->backend == PQ_CALENDAR)
+		return pq_calendar_first(pq);
+	return pq->length ? pq_heap(pq)[0].ev : NULL;
+}
+
+PQEvent* pqevent_next(PriorityQueue *pq)
+{
+	assert(pq);
+	if (pq->backend == PQ_CALENDAR)
+		return pq_calendar_next(pq);
+	PQEvent *r = pq->length ? pq_heap(pq)[0].ev : NULL;
+	if (!pq_pop_front(pq)) return NULL;
+	return r;
 }
 
-void pqevent_delete(PQEvent *ev)
+void pqevent_delete(PriorityQueue *pq, PQEvent *ev)
 {
-	free(ev);
+	assert(pq);
+	if (!ev) return;
+	ev->next = pq->pool.free;
+	pq->pool.free = ev;
+	pq->pool.nr_release++;
 }
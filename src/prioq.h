@@ -2,16 +2,12 @@
 #define PRIOQ_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "config.h"
 #include "graph.h"
 #include "vector.h"
 
-extern List ListS;
-extern List ListI;
-extern List ListR;
-
-#define PROB_T 0.5
-#define PROB_Y 0.2
-
 enum eventtype {
 	TRANSMIT = 1,
 	RECOVER,
@@ -20,6 +16,16 @@ enum eventtype {
 
 typedef enum eventtype EventType;
 
+enum pq_backend {
+	/* 4-ary min heap, for arbitrary timestamps */
+	PQ_HEAP,
+	/* calendar queue with a bucket per day, for bounded timestamps */
+	PQ_CALENDAR,
+	_PQ_BACKEND_MAX,
+};
+
+typedef enum pq_backend PQBackend;
+
 typedef struct priorityqueue PriorityQueue;
 typedef struct pqevent PQEvent;
 
@@ -27,30 +33,122 @@ struct pqevent {
 	/* virtual timestamp of event */
 	unsigned long timestamp;
 	EventType type;
-	/* node owning the event */
-	Node *node;
+	/* id of the node that caused the event, 0 if none; fits in
+	   the padding after type */
+	unsigned int cause;
+	/* index of the node owning the event */
+	unsigned int node;
 	union {
 		double T;
 		double Y;
 	};
+	/* free list link while the event is not in use, bucket link
+	   while it is queued in a calendar */
+	PQEvent *next;
+	union {
+		/* PQ_HEAP: index of its entry while queued */
+		size_t slot;
+		/* PQ_CALENDAR: bucket link back */
+		PQEvent *prev;
+	};
+};
+
+/* number of events carved out of a single slab allocation */
+#define PQEVENT_SLAB_NR 4096U
+
+struct pqevent_slab {
+	struct pqevent_slab *next;
+	PQEvent events[PQEVENT_SLAB_NR];
+};
+
+/* Events are carved out of slabs and recycled through a free list, so
+ * the steady state of a simulation does no allocation at all. Slabs
+ * come from an arena sized for the events a scenario can have queued,
+ * and are only given back to the system all at once, in pq_delete().
+ */
+struct pqevent_pool {
+	struct pqevent_slab *slabs;
+	PQEvent *free;
+	Arena arena;
+	/* number of slabs carved out */
+	size_t nr_slabs;
+	/* events handed out and given back */
+	size_t nr_alloc;
+	size_t nr_release;
+	/* high water mark of events in use */
+	size_t max_live;
+};
+
+/* children per heap node, a group of siblings fills one cache line */
+#define PQ_HEAP_ARITY 4
+#define PQ_HEAP_ALIGN 64U
+/* unused slots in front of the root, so that the children of node i,
+   at 4i + 1 to 4i + 4, start on a cache line boundary */
+#define PQ_HEAP_ROOT  (PQ_HEAP_ARITY - 1)
+/* low bits of the key hold the insertion sequence, high bits the time */
+#define PQ_SEQ_BITS   40
+#define PQ_TS_MAX     ((UINT64_C(1) << (64 - PQ_SEQ_BITS)) - 1)
+#define PQ_SEQ_MASK ((UINT64_C(1) << PQ_SEQ_BITS) - 1)
+
+/* Heap entries carry their sort key inline, so comparisons never
+ * touch the events themselves; only the entries that move are written
+ * back to their event, which keeps its slot for pqevent_update(). Equal
+ * timestamps are ordered by insertion.
+ */
+struct pq_entry {
+	uint64_t key;
+	PQEvent *ev;
+};
+
+_Static_assert(sizeof(struct pq_entry) * PQ_HEAP_ARITY == PQ_HEAP_ALIGN,
+	       "heap siblings must fill a cache line");
+
+/* the heap array, padding included */
+VECTOR_DEFINE_ALIGNED(struct pq_entry, pq_entries, PQ_HEAP_ALIGN)
+
+/* FIFO of events due on the same day */
+struct pq_bucket {
+	PQEvent *head;
+	PQEvent *tail;
 };
 
 struct priorityqueue {
-	Vector *vec;
-        PQEvent **events;
+	PQBackend backend;
+	/* scenario being run, gives event probabilities and horizon */
+	const Config *cfg;
+	/* PQ_HEAP, the root is at PQ_HEAP_ROOT, see pq_heap() */
+	struct pq_entries entries;
+	/* insertion counter for tie-breaking */
+	uint64_t seq;
+	/* PQ_CALENDAR: bucket i holds events due on day i, the last one
+	   collects everything beyond the horizon */
+	struct pq_bucket *buckets;
+	size_t nr_buckets;
+	/* no bucket before this one holds an event */
+	size_t cursor;
+	/* number of queued events, for either backend */
+	size_t length;
+	struct pqevent_pool pool;
 };
 
-PriorityQueue* pq_new(void);
+/* Looked up on every use rather than cached, as a push or pop may
+ * move the entries.
+ */
+static inline struct pq_entry* pq_heap(const PriorityQueue *pq)
+{
+	return pq->entries.p + PQ_HEAP_ROOT;
+}
+
+PriorityQueue* pq_new(PQBackend backend, const Config *cfg);
+bool pq_reset(PriorityQueue *pq, const Config *cfg);
 void pq_delete(PriorityQueue *pq);
 
-PQEvent* pqevent_new(Node *node, EventType type);
+PQEvent* pqevent_new(PriorityQueue *pq, size_t node, EventType type);
 bool pqevent_add(PriorityQueue *pq, PQEvent *ev);
+bool pqevent_add_many(PriorityQueue *pq, PQEvent **evs, size_t n);
+void pqevent_update(PriorityQueue *pq, PQEvent *ev, unsigned long timestamp);
+PQEvent* pqevent_peek(PriorityQueue *pq);
 PQEvent* pqevent_next(PriorityQueue *pq);
-void process_trans_SIR(PriorityQueue *pq, PQEvent *ev);
-void process_rec_SIR(PriorityQueue *pq, PQEvent *ev);
-void pqevent_delete(PQEvent *ev);
-
-size_t gen_random_id(size_t b, size_t except);
-size_t toss_coin(size_t ts, double bias);
+void pqevent_delete(PriorityQueue *pq, PQEvent *ev);
 
 #endif
@@ -0,0 +1,151 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rng.h"
+
+static const char *kind_name[_RNG_KIND_MAX] = {
+	[RNG_PHILOX] = "philox",
+	[RNG_THREEFRY] = "threefry",
+};
+
+void rng_init(Rng *r, RngKind kind, uint64_t seed, uint64_t replicate)
+{
+	assert(kind < _RNG_KIND_MAX);
+	r->kind = kind;
+	r->key[0] = seed;
+	r->key[1] = replicate;
+}
+
+bool rng_kind_parse(const char *name, RngKind *kind)
+{
+	for (int i = 0; i < _RNG_KIND_MAX; i++) {
+		if (!strcmp(name, kind_name[i])) {
+			*kind = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* rng_kind_name(RngKind kind)
+{
+	assert(kind < _RNG_KIND_MAX);
+	return kind_name[kind];
+}
+
+static inline uint64_t mulhilo(uint64_t a, uint64_t b, uint64_t *hi)
+{
+	unsigned __int128 p = (unsigned __int128) a * b;
+	*hi = p >> 64;
+	return p;
+}
+
+/* Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC11 */
+static void philox4x64_10(const uint64_t key[2], const uint64_t ctr[4], uint64_t out[4])
+{
+	uint64_t k0 = key[0], k1 = key[1];
+	uint64_t x0 = ctr[0], x1 = ctr[1], x2 = ctr[2], x3 = ctr[3];
+	for (int i = 0; i < 10; i++) {
+		uint64_t hi0, hi1;
+		uint64_t lo0 = mulhilo(UINT64_C(0xD2E7470EE14C6C93), x0, &hi0);
+		uint64_t lo1 = mulhilo(UINT64_C(0xCA5A826395121157), x2, &hi1);
+		x0 = hi1 ^ x1 ^ k0;
+		x1 = lo1;
+		x2 = hi0 ^ x3 ^ k1;
+		x3 = lo0;
+		k0 += UINT64_C(0x9E3779B97F4A7C15);
+		k1 += UINT64_C(0xBB67AE8584CAA73B);
+	}
+	out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+}
+
+static inline uint64_t rotl(uint64_t x, unsigned int r)
+{
+	return x << r | x >> (64 - r);
+}
+
+static void threefry4x64_20(const uint64_t key[2], const uint64_t ctr[4], uint64_t out[4])
+{
+	static const unsigned int rot[8][2] = {
+		{ 14, 16 }, { 52, 57 }, { 23, 40 }, {  5, 37 },
+		{ 25, 33 }, { 46, 12 }, { 58, 22 }, { 32, 32 },
+	};
+	/* the upper half of the 256-bit key is zero */
+	uint64_t ks[5] = { key[0], key[1], 0, 0 };
+	ks[4] = UINT64_C(0x1BD11BDAA9FC1A22) ^ ks[0] ^ ks[1] ^ ks[2] ^ ks[3];
+	uint64_t x[4];
+	for (int i = 0; i < 4; i++)
+		x[i] = ctr[i] + ks[i];
+	for (int r = 0; r < 20; r++) {
+		const unsigned int *R = rot[r % 8];
+		if (r % 2 == 0) {
+			x[0] += x[1]; x[1] = rotl(x[1], R[0]); x[1] ^= x[0];
+			x[2] += x[3]; x[3] = rotl(x[3], R[1]); x[3] ^= x[2];
+		} else {
+			x[0] += x[3]; x[3] = rotl(x[3], R[0]); x[3] ^= x[0];
+			x[2] += x[1]; x[1] = rotl(x[1], R[1]); x[1] ^= x[2];
+		}
+		/* key injection after every fourth round */
+		if (r % 4 == 3) {
+			unsigned int s = r / 4 + 1;
+			for (int i = 0; i < 4; i++)
+				x[i] += ks[(s + i) % 5];
+			x[3] += s;
+		}
+	}
+	memcpy(out, x, sizeof x);
+}
+
+void rng_block(const Rng *r, const uint64_t ctr[4], uint64_t out[4])
+{
+	if (r->kind == RNG_THREEFRY)
+		threefry4x64_20(r->key, ctr, out);
+	else
+		philox4x64_10(r->key, ctr, out);
+}
+
+void rng_stream_init(RngStream *st, const Rng *r, enum rng_domain domain,
+		     uint64_t id, uint64_t sub)
+{
+	assert(domain < _RNG_DOMAIN_MAX);
+	st->rng = r;
+	st->ctr[0] = domain;
+	st->ctr[1] = id;
+	st->ctr[2] = sub;
+	st->ctr[3] = 0;
+	st->avail = 0;
+}
+
+uint64_t rng_next(RngStream *st)
+{
+	if (!st->avail) {
+		rng_block(st->rng, st->ctr, st->buf);
+		st->ctr[3]++;
+		st->avail = 4;
+	}
+	return st->buf[4 - st->avail--];
+}
+
+/* uniform in [0, 1), with 53 bits of precision */
+double rng_uniform(RngStream *st)
+{
+	return (rng_next(st) >> 11) * 0x1.0p-53;
+}
+
+/* uniform in [0, bound) without modulo bias, Lemire's method */
+uint64_t rng_bounded(RngStream *st, uint64_t bound)
+{
+	assert(bound);
+	unsigned __int128 m = (unsigned __int128) rng_next(st) * bound;
+	uint64_t lo = m;
+	if (lo < bound) {
+		uint64_t t = -bound % bound;
+		while (lo < t) {
+			m = (unsigned __int128) rng_next(st) * bound;
+			lo = m;
+		}
+	}
+	return m >> 64;
+}
@@ -0,0 +1,64 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Counter-based generators: a draw is a pure function of a key and a
+ * counter, with no hidden state. Keying by (seed, replicate) and
+ * addressing draws by what they decide (domain, entity, sub-entity)
+ * makes every decision reproducible, whichever thread makes it and in
+ * whichever order.
+ */
+enum rng_kind {
+	/* Philox4x64-10, multiply based */
+	RNG_PHILOX,
+	/* Threefry4x64-20, add/rotate/xor only */
+	RNG_THREEFRY,
+	_RNG_KIND_MAX,
+};
+
+typedef enum rng_kind RngKind;
+
+/* what a draw is used for, first word of the counter */
+enum rng_domain {
+	RNG_GRAPH = 1,
+	RNG_SEED,
+	RNG_SEED_RECOVER,
+	RNG_TRANSMIT,
+	RNG_RECOVER,
+	_RNG_DOMAIN_MAX,
+};
+
+struct rng {
+	RngKind kind;
+	uint64_t key[2];
+};
+
+typedef struct rng Rng;
+
+/* Draws of one decision, e.g. the transmission delay over one edge.
+ * Each block yields four 64-bit words, the last counter word numbers
+ * the blocks.
+ */
+struct rng_stream {
+	const Rng *rng;
+	uint64_t ctr[4];
+	uint64_t buf[4];
+	unsigned int avail;
+};
+
+typedef struct rng_stream RngStream;
+
+void rng_init(Rng *r, RngKind kind, uint64_t seed, uint64_t replicate);
+bool rng_kind_parse(const char *name, RngKind *kind);
+const char* rng_kind_name(RngKind kind);
+void rng_block(const Rng *r, const uint64_t ctr[4], uint64_t out[4]);
+
+void rng_stream_init(RngStream *st, const Rng *r, enum rng_domain domain,
+		     uint64_t id, uint64_t sub);
+uint64_t rng_next(RngStream *st);
+double rng_uniform(RngStream *st);
+uint64_t rng_bounded(RngStream *st, uint64_t bound);
+
+#endif
@@ -0,0 +1,507 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "gen.h"
+#include "graph.h"
+#include "prioq.h"
+#include "rng.h"
+#include "shard.h"
+#include "sim.h"
+#include "stats.h"
+#include "vector.h"
+#include "log.h"
+
+/* passes of the refinement after growing the shards */
+#define SHARD_PASSES 2
+/* nodes queued for the breadth first order, not yet placed */
+#define SHARD_QUEUED UINT32_MAX
+
+void shard_plan_release(ShardPlan *p)
+{
+	free(p->part);
+	free(p->local);
+	free(p->nodes);
+	free(p->first);
+	*p = (ShardPlan) {};
+}
+
+/* Moves each node to the shard most of its neighbours are in, as long
+ * as no shard gets more than about 3% off the mean size.
+ */
+static void shard_refine(ShardPlan *p, const Graph *g, size_t *size, size_t *count)
+{
+	size_t n = g->nr_nodes, mean = n / p->nr_shards;
+	size_t hi = mean + mean / 32 + 1, lo = mean - mean / 32;
+
+	for (int pass = 0; pass < SHARD_PASSES; pass++) {
+		for (size_t i = 0; i < n; i++) {
+			uint32_t from = p->part[i], to = from;
+			size_t k;
+			graph_for_each_neigh(g, i, k)
+				count[p->part[g->adj[k]]]++;
+			graph_for_each_neigh(g, i, k) {
+				uint32_t s = p->part[g->adj[k]];
+				if (count[s] > count[to])
+					to = s;
+			}
+			graph_for_each_neigh(g, i, k)
+				count[p->part[g->adj[k]]] = 0;
+			if (to == from || size[to] >= hi || size[from] <= lo)
+				continue;
+			p->part[i] = to;
+			size[from]--;
+			size[to]++;
+		}
+	}
+}
+
+bool shard_partition(ShardPlan *p, const Graph *g, unsigned int nr_shards)
+{
+	size_t n = g->nr_nodes, head = 0, tail = 0;
+
+	assert(nr_shards && nr_shards <= n);
+	*p = (ShardPlan) { .nr_shards = nr_shards };
+	p->part = malloc(n * sizeof *p->part);
+	p->local = malloc(n * sizeof *p->local);
+	p->nodes = malloc(n * sizeof *p->nodes);
+	p->first = calloc(nr_shards + 1, sizeof *p->first);
+	size_t *size = calloc(nr_shards, sizeof *size);
+	size_t *count = calloc(nr_shards, sizeof *count);
+	if (!p->part || !p->local || !p->nodes || !p->first || !size || !count) {
+		free(size);
+		free(count);
+		shard_plan_release(p);
+		return false;
+	}
+	/* equal runs of the breadth first order, nodes serves as the queue */
+	for (size_t i = 0; i < n; i++)
+		p->part[i] = SHARD_QUEUED;
+	for (size_t r = 0; r < n; r++) {
+		if (p->part[r] != SHARD_QUEUED)
+			continue;
+		p->part[r] = nr_shards;
+		p->nodes[tail++] = r;
+		while (head < tail) {
+			size_t k, i = p->nodes[head];
+			p->part[i] = head++ * nr_shards / n;
+			size[p->part[i]]++;
+			graph_for_each_neigh(g, i, k) {
+				unsigned int j = g->adj[k];
+				if (p->part[j] != SHARD_QUEUED) continue;
+				p->part[j] = nr_shards;
+				p->nodes[tail++] = j;
+			}
+		}
+	}
+	shard_refine(p, g, size, count);
+	free(size);
+	free(count);
+
+	for (size_t i = 0; i < n; i++) {
+		size_t k;
+		p->first[p->part[i] + 1]++;
+		graph_for_each_neigh(g, i, k)
+			if (g->adj[k] > i && p->part[g->adj[k]] != p->part[i])
+				p->cut++;
+	}
+	for (unsigned int s = 0; s < nr_shards; s++)
+		p->first[s + 1] += p->first[s];
+	/* first[s] runs ahead while placing, and ends up at first[s + 1] */
+	for (size_t i = 0; i < n; i++) {
+		size_t at = p->first[p->part[i]]++;
+		p->nodes[at] = i;
+		p->local[i] = at;
+	}
+	memmove(p->first + 1, p->first, nr_shards * sizeof *p->first);
+	p->first[0] = 0;
+	for (size_t i = 0; i < n; i++)
+		p->local[i] -= p->first[p->part[i]];
+	return true;
+}
+
+static size_t shard_align(size_t x)
+{
+	return (x + 63) & ~(size_t) 63;
+}
+
+static struct shard_region* shard_region_map(unsigned int nr, size_t n, size_t days)
+{
+	size_t at_next = shard_align(sizeof(struct shard_region));
+	size_t at_stats = shard_align(at_next + nr * sizeof(unsigned long));
+	size_t at_curve = shard_align(at_stats + nr * sizeof(struct sim_stats));
+	size_t at_rings = shard_align(at_curve + nr * days * sizeof(struct sir_count));
+	size_t at_state = at_rings + (size_t) nr * nr * sizeof(struct shard_ring);
+	size_t size = at_state + n;
+
+	/* zero filled, which makes every ring empty */
+	unsigned char *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (m == MAP_FAILED)
+		return NULL;
+	struct shard_region *r = (struct shard_region *) m;
+	r->nr_shards = nr;
+	r->next = (unsigned long *) (m + at_next);
+	r->stats = (struct sim_stats *) (m + at_stats);
+	r->curve = (struct sir_count *) (m + at_curve);
+	r->rings = (struct shard_ring *) (m + at_rings);
+	r->state = m + at_state;
+	r->size = size;
+	memset(r->state, SIR_SUSCEPTIBLE, n);
+	return r;
+}
+
+VECTOR_DEFINE(struct shard_msg, shard_msgs)
+
+/* one process of the run, on its own copy of the context */
+struct shard {
+	const ShardPlan *p;
+	struct shard_region *r;
+	unsigned int id;
+	Sim *s;
+	/* local indices of the nodes that changed state in the round */
+	struct node_vec changed;
+	/* messages taken from the ring of each other shard, applied in
+	   the order of the shards once the round is over */
+	struct shard_msgs *inbox;
+};
+
+static inline size_t shard_global(const struct shard *sh, size_t local)
+{
+	return sh->p->nodes[sh->p->first[sh->id] + local];
+}
+
+/* empties the rings into this shard */
+static bool shard_drain(struct shard *sh)
+{
+	unsigned int nr = sh->r->nr_shards;
+
+	for (unsigned int src = 0; src < nr; src++) {
+		if (src == sh->id) continue;
+		struct shard_ring *q = &sh->r->rings[src * nr + sh->id];
+		size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+		size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+		for (; head != tail; head++)
+			if (shard_msgs_push(&sh->inbox[src], q->msg[head % SHARD_RING_NR]) < 0)
+				return false;
+		atomic_store_explicit(&q->head, head, memory_order_release);
+	}
+	return true;
+}
+
+/* Waits for every shard, taking in messages meanwhile so that a shard
+ * still sending never waits on one that is here.
+ */
+static bool shard_barrier(struct shard *sh)
+{
+	struct shard_region *r = sh->r;
+	unsigned int gen = atomic_load(&r->gen);
+
+	if (atomic_fetch_add(&r->arrived, 1) + 1 == r->nr_shards) {
+		atomic_store(&r->arrived, 0);
+		atomic_fetch_add(&r->gen, 1);
+		return !atomic_load(&r->failed);
+	}
+	while (atomic_load(&r->gen) == gen) {
+		if (atomic_load(&r->failed) || !shard_drain(sh))
+			return false;
+		sched_yield();
+	}
+	return !atomic_load(&r->failed);
+}
+
+static bool shard_send(struct shard *sh, unsigned int dst, const struct shard_msg *m)
+{
+	struct shard_ring *q = &sh->r->rings[sh->id * sh->r->nr_shards + dst];
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+	while (tail - atomic_load_explicit(&q->head, memory_order_acquire) == SHARD_RING_NR) {
+		/* dst may be waiting on a ring of ours */
+		if (atomic_load(&sh->r->failed) || !shard_drain(sh))
+			return false;
+		sched_yield();
+	}
+	q->msg[tail % SHARD_RING_NR] = *m;
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+/* sim_schedule() for a node of any shard */
+static bool shard_schedule(struct shard *sh, size_t n, EventType type, unsigned long ts,
+			   unsigned int cause)
+{
+	uint32_t dst = sh->p->part[n];
+
+	if (dst == sh->id)
+		return sim_schedule(sh->s, sh->p->local[n], type, ts, cause);
+	return shard_send(sh, dst, &(struct shard_msg) { n, ts, cause, type });
+}
+
+/* current for the nodes of this shard, as of the last round for others */
+static inline Status shard_status(const struct shard *sh, size_t n)
+{
+	if (sh->p->part[n] == sh->id)
+		return sh->s->nodes.state[sh->p->local[n]];
+	return sh->r->state[n];
+}
+
+static bool shard_move(struct shard *sh, unsigned int local, Status to)
+{
+	node_move(&sh->s->nodes, local, to);
+	return node_vec_push(&sh->changed, local) >= 0;
+}
+
+/* process_trans_SIR() with the neighbours looked up across shards */
+static bool shard_transmit(struct shard *sh, PQEvent *ev)
+{
+	Sim *s = sh->s;
+	Graph *g = s->g;
+	size_t k, i = shard_global(sh, ev->node);
+
+	if (s->nodes.state[ev->node] != SIR_SUSCEPTIBLE)
+		return true;
+	if (!shard_move(sh, ev->node, SIR_INFECTED))
+		return false;
+	s->new_inf++;
+	graph_for_each_neigh(g, i, k) {
+		size_t n = g->adj[k];
+		Status st = shard_status(sh, n);
+		if (st == SIR_INFECTED) continue;
+		RngStream rs;
+		rng_stream_init(&rs, &s->rng, RNG_TRANSMIT, i, k - g->off[i]);
+		unsigned long t = toss_coin(&rs, ev->timestamp, ev->T, s->cfg.time_max);
+		ev->timestamp += t - ev->timestamp;
+		if (st == SIR_RECOVERED) continue;
+		if (!shard_schedule(sh, n, TRANSMIT, t, i + 1))
+			return false;
+		rng_stream_init(&rs, &s->rng, RNG_RECOVER, i, k - g->off[i]);
+		t = toss_coin(&rs, ev->timestamp, ev->Y, s->cfg.time_max) + DETECT_DAYS;
+		if (!shard_schedule(sh, n, RECOVER, t, i + 1))
+			return false;
+	}
+	return true;
+}
+
+/* the draws of sim_seed(), keeping the spreaders of this shard */
+static bool shard_seed(struct shard *sh)
+{
+	Sim *s = sh->s;
+	size_t n = s->cfg.sample_size;
+	RngStream st, rec;
+
+	rng_stream_init(&st, &s->rng, RNG_SEED, 0, 0);
+	size_t infect = gen_random_id(&st, n, 0);
+	while (infect--) {
+		size_t r = gen_random_id(&st, n, -1), l = sh->p->local[r];
+		if (sh->p->part[r] != sh->id || bit_test(s->nodes.initial, l))
+			continue;
+		rng_stream_init(&rec, &s->rng, RNG_SEED_RECOVER, r, 0);
+		unsigned long t = toss_coin(&rec, 0, s->cfg.prob_y, s->cfg.time_max) + DETECT_DAYS;
+		if (!sim_schedule(s, l, TRANSMIT, 0, 0) || !sim_schedule(s, l, RECOVER, t, 0))
+			return false;
+		bit_set(s->nodes.initial, l);
+	}
+	return true;
+}
+
+/* the queued events up to day now, as sim_simulate() runs them */
+static bool shard_round(struct shard *sh, unsigned long now)
+{
+	Sim *s = sh->s;
+	PriorityQueue *pq = s->pq;
+	NodeStore *ns = &s->nodes;
+	PQEvent *ev;
+
+	while ((ev = pqevent_peek(pq)) && ev->timestamp <= now) {
+		ev = pqevent_next(pq);
+		*node_pending(ns, ev->node, ev->type) = NULL;
+		stats_add(s->stats.queue_sum, pq->length);
+		stats_inc(s->stats.queue_samples);
+		stats_max(s->stats.queue_peak, pq->length);
+		Status st = ns->state[ev->node];
+		bool run, ok = true;
+		if (ev->type == TRANSMIT)
+			run = st == SIR_SUSCEPTIBLE || st == SIR_RECOVERED ||
+				(ev->timestamp == 0 && st == SIR_INFECTED);
+		else
+			run = ev->type == RECOVER && st != SIR_RECOVERED;
+		if (run && ev->type == TRANSMIT)
+			ok = shard_transmit(sh, ev);
+		else if (run)
+			ok = shard_move(sh, ev->node, SIR_RECOVERED);
+		if (run)
+			stats_inc(s->stats.processed[ev->type]);
+		else
+			stats_inc(s->stats.skipped[ev->type]);
+		pqevent_delete(pq, ev);
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+
+/* Between rounds: queue the events from other shards, publish the
+ * states that changed, and tell when the next event of this shard is.
+ */
+static bool shard_exchange(struct shard *sh)
+{
+	Sim *s = sh->s;
+	struct shard_region *r = sh->r;
+
+	if (!shard_drain(sh))
+		return false;
+	for (unsigned int src = 0; src < r->nr_shards; src++) {
+		const struct shard_msg *m = sh->inbox[src].p;
+		for (size_t i = 0; i < sh->inbox[src].length; i++)
+			if (!sim_schedule(s, sh->p->local[m[i].node], m[i].type, m[i].ts, m[i].cause))
+				return false;
+		shard_msgs_clear(&sh->inbox[src]);
+	}
+	const unsigned int *c = sh->changed.p;
+	for (size_t i = 0; i < sh->changed.length; i++)
+		r->state[shard_global(sh, c[i])] = s->nodes.state[c[i]];
+	node_vec_clear(&sh->changed);
+	PQEvent *ev = pqevent_peek(s->pq);
+	r->next[sh->id] = ev ? ev->timestamp : ULONG_MAX;
+	return true;
+}
+
+/* Rounds run in lockstep: every shard runs its events up to the
+ * earliest day queued anywhere. Events sent to other shards are mostly
+ * a day later or more, but toss_coin() clamps days to time_max -
+ * DETECT_DAYS, so close to the horizon they can arrive for the day just
+ * run or one before it. Those are not lost: the next round takes now
+ * from the queues again, which gives their day, and runs them late, as
+ * the serial loop does when it pops them after later days.
+ */
+static bool shard_work(struct shard *sh)
+{
+	Sim *s = sh->s;
+	struct shard_region *r = sh->r;
+	size_t n = sh->p->first[sh->id + 1] - sh->p->first[sh->id];
+	size_t days = s->cfg.time_max, rec = 0;
+
+	/* the copy of the context holds this shard only */
+	s->out = NULL;
+	s->trace = NULL;
+	s->stats = (struct sim_stats) {};
+	s->new_inf = 0;
+	node_store_release(&s->nodes);
+	sh->inbox = calloc(r->nr_shards, sizeof *sh->inbox);
+	if (!sh->inbox || !node_store_reset(&s->nodes, n) || !pq_reset(s->pq, &s->cfg))
+		return false;
+
+	if (!shard_seed(sh) || !shard_exchange(sh))
+		return false;
+	for (;;) {
+		if (!shard_barrier(sh))
+			return false;
+		unsigned long now = ULONG_MAX;
+		for (unsigned int i = 0; i < r->nr_shards; i++)
+			if (r->next[i] < now)
+				now = r->next[i];
+		if (now >= days)
+			break;
+		for (; rec < now; rec++)
+			sim_record(s, rec);
+		if (!shard_round(sh, now) || !shard_barrier(sh) || !shard_exchange(sh))
+			return false;
+	}
+	for (; rec < days; rec++)
+		sim_record(s, rec);
+	memcpy(r->curve + sh->id * days, s->curve, days * sizeof *s->curve);
+	stats_add(s->stats.pool_alloc, s->pq->pool.nr_alloc);
+	stats_add(s->stats.pool_release, s->pq->pool.nr_release);
+	stats_max(s->stats.pool_peak, s->pq->pool.max_live);
+	stats_max(s->stats.pool_slabs, s->pq->pool.nr_slabs);
+	r->stats[sh->id] = s->stats;
+	return true;
+}
+
+/* Runs the replicate of s, reset and on its graph but not seeded, in
+ * a process per shard of p. The curve goes to s as from sim_simulate().
+ */
+bool shard_simulate(const ShardPlan *p, Sim *s)
+{
+	unsigned int nr = p->nr_shards, started;
+	size_t n = s->cfg.sample_size, days = s->cfg.time_max;
+	bool ret = true;
+
+	if (days > UINT32_MAX) {
+		log_error("time_max must be below %u to run in shards.", UINT32_MAX);
+		return false;
+	}
+	struct shard_region *r = shard_region_map(nr, n, days);
+	if (!r) {
+		log_error("Failed to map memory for %u shards.", nr);
+		return false;
+	}
+	/* or the children write out what is buffered once more */
+	log_sync();
+	fflush(stderr);
+	for (started = 0; started < nr; started++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			log_error("Failed to start shard %u: %s", started, strerror(errno));
+			atomic_store(&r->failed, true);
+			ret = false;
+			break;
+		}
+		if (!pid) {
+			/* the log thread is left in the parent */
+			log_async_on = false;
+			struct shard sh = { .p = p, .r = r, .id = started, .s = s };
+			bool ok = shard_work(&sh);
+			if (!ok) {
+				if (!atomic_exchange(&r->failed, true))
+					log_error("Shard %u failed.", started);
+			}
+			fflush(stderr);
+			_exit(!ok);
+		}
+	}
+	/* in whatever order they end, a failed one lets the others go */
+	for (unsigned int i = 0; i < started; i++) {
+		int status;
+		if (wait(&status) < 0)
+			break;
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			atomic_store(&r->failed, true);
+			ret = false;
+		}
+	}
+	if (ret) {
+		for (size_t d = 0; d < days; d++) {
+			struct sir_count c = {};
+			for (unsigned int i = 0; i < nr; i++) {
+				struct sir_count *sc = &r->curve[i * days + d];
+				c.s += sc->s;
+				c.i += sc->i;
+				c.r += sc->r;
+				c.new_inf += sc->new_inf;
+			}
+			s->curve[d] = c;
+			if (s->out)
+				curve_write(s->out, s->rng.key[1], d, &c);
+		}
+		for (unsigned int i = 0; i < nr; i++)
+			stats_merge(&s->stats, &r->stats[i]);
+		stats_inc(s->stats.runs);
+		/* the outcome, for the counts and lists of the context */
+		for (size_t i = 0; i < n; i++)
+			if (r->state[i] != SIR_SUSCEPTIBLE)
+				node_move(&s->nodes, i, r->state[i]);
+	}
+	munmap(r, r->size);
+	return ret;
+}
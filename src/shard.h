@@ -0,0 +1,76 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "graph.h"
+#include "sim.h"
+#include "stats.h"
+
+/* Which process owns which node. Shards are grown breadth first in
+ * equal parts and then refined by moving nodes to the shard most of
+ * their neighbours are in, so few edges cross between shards.
+ */
+struct shard_plan {
+	unsigned int nr_shards;
+	/* shard of node i, and its index among the nodes of that shard */
+	uint32_t *part;
+	uint32_t *local;
+	/* nodes of shard s at nodes[first[s]] up to first[s + 1], by id */
+	uint32_t *nodes;
+	size_t *first;
+	/* edges between two shards */
+	size_t cut;
+};
+
+typedef struct shard_plan ShardPlan;
+
+/* A TRANSMIT or RECOVER event for a node of another shard */
+struct shard_msg {
+	uint32_t node;
+	uint32_t ts;
+	uint32_t cause;
+	uint32_t type;
+};
+
+#define SHARD_RING_NR 1024U
+
+/* Single producer, single consumer, from one shard to another. Head
+ * and tail count the messages ever taken and put.
+ */
+struct shard_ring {
+	_Alignas(64) atomic_size_t head;
+	_Alignas(64) atomic_size_t tail;
+	struct shard_msg msg[SHARD_RING_NR];
+};
+
+/* Shared between the processes of a run, mapped before they fork,
+ * with the arrays following it in the same mapping.
+ */
+struct shard_region {
+	unsigned int nr_shards;
+	/* processes waiting at the barrier, and how many times it opened */
+	atomic_uint arrived;
+	atomic_uint gen;
+	atomic_bool failed;
+	/* day of the earliest event queued in each shard */
+	unsigned long *next;
+	/* what each shard did, and its curve */
+	struct sim_stats *stats;
+	struct sir_count *curve;
+	/* ring from shard a to shard b at a * nr_shards + b */
+	struct shard_ring *rings;
+	/* state of every node as of the last round, written by its owner
+	   between rounds only */
+	uint8_t *state;
+	size_t size;
+};
+
+bool shard_partition(ShardPlan *p, const Graph *g, unsigned int nr_shards);
+void shard_plan_release(ShardPlan *p);
+bool shard_simulate(const ShardPlan *p, Sim *s);
+
+#endif
@@ -0,0 +1,347 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "dist.h"
+#include "gen.h"
+#include "graph.h"
+#include "prioq.h"
+#include "rng.h"
+#include "trace.h"
+#include "sim.h"
+#include "stats.h"
+#include "log.h"
+
+bool sim_init(Sim *s, const Config *cfg)
+{
+	*s = (Sim) { .cfg = *cfg };
+	s->g = &s->graph;
+	s->pq = pq_new(PQ_BACKEND, &s->cfg);
+	if (!s->pq) {
+		log_error("Failed to setup priority queue, fatal.");
+		return false;
+	}
+	s->seed = vector_new(sizeof(PQEvent*));
+	if (!s->seed) {
+		log_error("Failed to allocate spreader list, fatal.");
+		return false;
+	}
+	return true;
+}
+
+void sim_release(Sim *s)
+{
+	graph_builder_release(&s->gb);
+	if (s->seed) {
+		vector_reset(s->seed);
+		free(s->seed);
+	}
+	graph_release(&s->graph);
+	node_store_release(&s->nodes);
+	free(s->curve);
+	pq_delete(s->pq);
+	*s = (Sim) {};
+}
+
+bool sim_reset(Sim *s, const Config *cfg)
+{
+	size_t n = cfg->sample_size;
+
+	s->cfg = *cfg;
+	rng_init(&s->rng, cfg->rng, cfg->seed, 0);
+	s->nr_conn = 0;
+	s->new_inf = 0;
+	s->day = 0;
+	s->halt_day = SIZE_MAX;
+	s->halt = NULL;
+
+	if (!pq_reset(s->pq, &s->cfg)) {
+		log_error("Failed to reset priority queue, fatal.");
+		return false;
+	}
+
+	if (!node_store_reset(&s->nodes, n)) {
+		log_error("Failed to allocate nodes, fatal.");
+		return false;
+	}
+
+	if (cfg->time_max > s->cap_curve) {
+		struct sir_count *c = reallocarray(s->curve, cfg->time_max, sizeof *c);
+		if (!c) {
+			log_error("Failed to allocate epidemic curve, fatal.");
+			return false;
+		}
+		s->curve = c;
+		s->cap_curve = cfg->time_max;
+	}
+	return true;
+}
+
+/* draw from the streams of another replicate, the graph stays as is */
+void sim_set_replicate(Sim *s, size_t replicate)
+{
+	rng_init(&s->rng, s->cfg.rng, s->cfg.seed, replicate);
+}
+
+/* use g, owned by someone else, instead of generating one */
+void sim_share_graph(Sim *s, Graph *g)
+{
+	assert(g->nr_nodes == s->cfg.sample_size);
+	s->g = g;
+}
+
+bool sim_generate(Sim *s, unsigned int nr_threads)
+{
+	size_t n = s->cfg.sample_size;
+
+	if (!graph_builder_init(&s->gb, n)) {
+		log_error("Failed to allocate edge list, fatal.");
+		return false;
+	}
+	if (!gen_graph(&s->gb, &s->cfg, nr_threads)) {
+		log_error("Failed to generate %s graph, fatal.", graph_model_name(s->cfg.model));
+		return false;
+	}
+	s->nr_conn = s->gb.edges->length;
+
+	s->g = &s->graph;
+	if (!graph_build(s->g, n, s->gb.edges)) {
+		log_error("Failed to build contact graph, fatal.");
+		return false;
+	}
+	return true;
+}
+
+bool sim_seed(Sim *s)
+{
+	PriorityQueue *pq = s->pq;
+	NodeStore *ns = &s->nodes;
+	size_t n = s->cfg.sample_size;
+
+	RngStream st, rec;
+	vector_clear(s->seed);
+	rng_stream_init(&st, &s->rng, RNG_SEED, 0, 0);
+	size_t infect = gen_random_id(&st, n, 0);
+	while (infect--) {
+		size_t r = gen_random_id(&st, n, -1);
+		if (bit_test(ns->initial, r))
+			continue;
+		PQEvent *ev[2];
+		ev[0] = pqevent_new(pq, r, TRANSMIT);
+		if (!ev[0]) {
+			log_warn("Failed to allocate TRANSMIT event for spreader %zu.", r + 1);
+			log_oom();
+			continue;
+		}
+		ev[0]->timestamp = 0;
+		ev[1] = pqevent_new(pq, r, RECOVER);
+		if (!ev[1]) {
+			log_warn("Failed to allocate RECOVER event for spreader %zu.", r + 1);
+			log_oom();
+			pqevent_delete(pq, ev[0]);
+			continue;
+		}
+		rng_stream_init(&rec, &s->rng, RNG_SEED_RECOVER, r, 0);
+		ev[1]->timestamp = toss_coin(&rec, 0, ev[1]->Y, s->cfg.time_max) + DETECT_DAYS;
+		if (vector_insert_many(s->seed, s->seed->length, ev, 2) < 0) {
+			log_warn("Failed to record events for spreader %zu.", r + 1);
+			pqevent_delete(pq, ev[0]);
+			pqevent_delete(pq, ev[1]);
+			continue;
+		}
+		log_trace("Added TRANSMIT event for initial spreader %zu with time %lu", r + 1, ev[0]->timestamp);
+		log_trace("Added RECOVER event for initial spreader %zu with time %lu", r + 1, ev[1]->timestamp);
+		if (s->trace) {
+			trace_event(s->trace, ev[0]->timestamp, TRANSMIT, r + 1, 0, TRACE_SCHEDULED);
+			trace_event(s->trace, ev[1]->timestamp, RECOVER, r + 1, 0, TRACE_SCHEDULED);
+		}
+		bit_set(ns->initial, r);
+		stats_inc(s->stats.scheduled[TRANSMIT]);
+		stats_inc(s->stats.scheduled[RECOVER]);
+	}
+
+	// queue all spreaders at once, the heap is built bottom-up
+	if (s->seed->length && !pqevent_add_many(pq, (PQEvent **) s->seed->p, s->seed->length)) {
+		log_error("Failed to queue initial spreaders, fatal.");
+		return false;
+	}
+	PQEvent **evs = (PQEvent **) s->seed->p;
+	for (size_t i = 0; i < s->seed->length; i++)
+		*node_pending(ns, evs[i]->node, evs[i]->type) = evs[i];
+	return true;
+}
+
+void sim_record(Sim *s, size_t day)
+{
+	size_t *c = s->nodes.count;
+	s->curve[day] = (struct sir_count) { c[SIR_SUSCEPTIBLE], c[SIR_INFECTED], c[SIR_RECOVERED], s->new_inf };
+	s->new_inf = 0;
+	if (s->out)
+		curve_write(s->out, s->rng.key[1], day, s->curve + day);
+}
+
+/* Runs from s->day on. Returns false when halted at the start of a
+ * day, with the queue as it stands then, to be taken up by another
+ * call; true once the run is over.
+ */
+bool sim_simulate(Sim *s)
+{
+	PriorityQueue *pq = s->pq;
+	NodeStore *ns = &s->nodes;
+	size_t day = s->day;
+
+	// begin simulation
+	PQEvent *ev;
+	while ((ev = pqevent_peek(pq)) && ev->timestamp < s->cfg.time_max) {
+		/* all of the earlier days are over */
+		for (; day < ev->timestamp; day++) {
+			sim_record(s, day);
+			if (day + 1 >= s->halt_day || (s->halt && *s->halt)) {
+				s->day = day + 1;
+				return false;
+			}
+		}
+		pqevent_next(pq);
+		*node_pending(ns, ev->node, ev->type) = NULL;
+		/* ev is still counted */
+		stats_add(s->stats.queue_sum, pq->length);
+		stats_inc(s->stats.queue_samples);
+		stats_max(s->stats.queue_peak, pq->length);
+		Status st = ns->state[ev->node];
+		bool run;
+		if (ev->type == TRANSMIT)
+			run = st == SIR_SUSCEPTIBLE || st == SIR_RECOVERED ||
+				(ev->timestamp == 0 && st == SIR_INFECTED);
+		else
+			run = ev->type == RECOVER && st != SIR_RECOVERED;
+		/* before processing, which moves the timestamp */
+		if (s->trace)
+			trace_event(s->trace, ev->timestamp, ev->type, ev->node + 1, ev->cause,
+				    run ? TRACE_PROCESSED : TRACE_SKIPPED);
+		if (run && ev->type == TRANSMIT) {
+			log_trace("Processing event TRANSMIT at time %lu for Node %u", ev->timestamp, ev->node + 1);
+			process_trans_SIR(s, ev);
+		} else if (run) {
+			log_trace("Processing event RECOVER at time %lu for Node %u", ev->timestamp, ev->node + 1);
+			process_rec_SIR(s, ev);
+		} /* else skip the event */
+		if (run)
+			stats_inc(s->stats.processed[ev->type]);
+		else
+			stats_inc(s->stats.skipped[ev->type]);
+		pqevent_delete(pq, ev);
+	}
+	for (; day < s->cfg.time_max; day++)
+		sim_record(s, day);
+	s->day = day;
+	stats_inc(s->stats.runs);
+	stats_add(s->stats.pool_alloc, pq->pool.nr_alloc);
+	stats_add(s->stats.pool_release, pq->pool.nr_release);
+	stats_max(s->stats.pool_peak, pq->pool.max_live);
+	/* slabs stay with the queue from one run to the next */
+	stats_max(s->stats.pool_slabs, pq->pool.nr_slabs);
+	/* events left in the queue past time_max go back to the pool on
+	   the next pq_reset(), or along with their slabs in pq_delete() */
+	return true;
+}
+
+/* Only the earliest of the events of a type for a node acts, the
+ * later ones would find it infected or recovered already. So a node has
+ * at most one of each queued, moved up when an earlier one comes.
+ */
+bool sim_schedule(Sim *s, size_t n, EventType type, unsigned long ts, unsigned int cause)
+{
+	PriorityQueue *pq = s->pq;
+	PQEvent **p = node_pending(&s->nodes, n, type), *e = *p;
+	const char *name = type == TRANSMIT ? "TRANSMIT" : "RECOVER";
+
+	/* dropped, counted but not traced: most schedules end here */
+	if (e && e->timestamp <= ts) {
+		stats_inc(s->stats.superseded[type]);
+		return true;
+	}
+	if (e) {
+		stats_inc(s->stats.superseded[type]);
+		if (s->trace)
+			trace_event(s->trace, e->timestamp, type, n + 1, e->cause, TRACE_SUPERSEDED);
+		e->cause = cause;
+		pqevent_update(pq, e, ts);
+	} else {
+		e = pqevent_new(pq, n, type);
+		if (!e) {
+			log_error("Failed to create %s event for Node %zu", name, n + 1);
+			log_oom();
+			return false;
+		}
+		e->timestamp = ts;
+		e->cause = cause;
+		if (!pqevent_add(pq, e)) {
+			log_error("Failed to add %s event for Node %zu", name, n + 1);
+			pqevent_delete(pq, e);
+			return false;
+		}
+		*p = e;
+	}
+	log_trace("Added %s event for Node %zu with time %lu", name, n + 1, ts);
+	stats_inc(s->stats.scheduled[type]);
+	if (s->trace)
+		trace_event(s->trace, ts, type, n + 1, cause, TRACE_SCHEDULED);
+	return true;
+}
+
+void process_trans_SIR(Sim *s, PQEvent *ev)
+{
+	assert(s);
+	assert(ev);
+	Graph *g = s->g;
+	NodeStore *ns = &s->nodes;
+	size_t k, i = ev->node;
+	/* If node is already infected, don't process this TRANSMIT
+	   event for it. Same for recovered. */
+	if (ns->state[i] == SIR_SUSCEPTIBLE) {
+		node_move(ns, i, SIR_INFECTED);
+		s->new_inf++;
+	} else return;
+	/* for each neighbour */
+	graph_for_each_neigh(g, i, k) {
+		size_t n = g->adj[k];
+		if (ns->state[n] == SIR_INFECTED) continue;
+		/* a node spreads once, so its id and the neighbour slot
+		   name the draws for this edge */
+		RngStream st;
+		rng_stream_init(&st, &s->rng, RNG_TRANSMIT, i, k - g->off[i]);
+		unsigned long t = toss_coin(&st, ev->timestamp, ev->T, s->cfg.time_max);
+		ev->timestamp += t - ev->timestamp;
+		/* neither event could change a recovered node */
+		if (ns->state[n] == SIR_RECOVERED) continue;
+		if (!sim_schedule(s, n, TRANSMIT, t, i + 1))
+			continue;
+		/* can only recover after being detected as infected */
+		rng_stream_init(&st, &s->rng, RNG_RECOVER, i, k - g->off[i]);
+		t = toss_coin(&st, ev->timestamp, ev->Y, s->cfg.time_max) + DETECT_DAYS;
+		sim_schedule(s, n, RECOVER, t, i + 1);
+	}
+}
+
+void process_rec_SIR(Sim *s, PQEvent *ev)
+{
+	assert(s);
+	assert(ev);
+	if (s->nodes.state[ev->node] != SIR_RECOVERED)
+		node_move(&s->nodes, ev->node, SIR_RECOVERED);
+}
+
+/* Day after ts on which a coin with the given bias first comes up
+ * heads, tossing once a day. Drawn in one go rather than tossed day by
+ * day, with the same cut off at the horizon.
+ */
+size_t toss_coin(RngStream *st, size_t ts, double bias, size_t horizon)
+{
+	assert(bias > 0.0 && bias <= 1.0);
+	assert(horizon > DETECT_DAYS);
+	assert(ts <= horizon);
+	/* no heads up to the horizon counts as one toss past it */
+	size_t t = dist_geometric(st, bias, horizon - ts + 1);
+	return ts + t + 1 < horizon - DETECT_DAYS ? ts + t + 1 : horizon - DETECT_DAYS;
+}
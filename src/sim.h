@@ -0,0 +1,74 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+#include "curve.h"
+#include "graph.h"
+#include "prioq.h"
+#include "rng.h"
+#include "stats.h"
+#include "trace.h"
+#include "vector.h"
+
+/* Everything one simulation run touches. Runs in different contexts
+ * share nothing but a read-only graph, so they can proceed on separate
+ * threads. A context is reused from one run to the next, and only
+ * grows its buffers when a run needs more.
+ */
+struct sim {
+	Config cfg;
+	PriorityQueue *pq;
+	NodeStore nodes;
+	/* points to graph when built here from gb, or to a graph
+	   borrowed from another context */
+	Graph *g;
+	Graph graph;
+	GraphBuilder gb;
+	size_t nr_conn;
+	/* events of the initial spreaders, queued in one go */
+	Vector *seed;
+	/* keyed by the seed and the replicate, every random decision
+	   has its own stream under it */
+	Rng rng;
+	/* S/I/R at the end of each day up to time_max */
+	struct sir_count *curve;
+	size_t cap_curve;
+	/* infections so far on the current day */
+	size_t new_inf;
+	/* first day not recorded yet, where sim_simulate() goes on */
+	size_t day;
+	/* sim_simulate() returns at the start of this day, or of any day
+	   once *halt is set */
+	size_t halt_day;
+	volatile sig_atomic_t *halt;
+	/* when set, each day is streamed here as it ends */
+	CurveWriter *out;
+	/* when set, every event is recorded here */
+	Trace *trace;
+	/* over every run in this context */
+	struct sim_stats stats;
+};
+
+typedef struct sim Sim;
+
+bool sim_init(Sim *s, const Config *cfg);
+void sim_release(Sim *s);
+bool sim_reset(Sim *s, const Config *cfg);
+void sim_set_replicate(Sim *s, size_t replicate);
+void sim_share_graph(Sim *s, Graph *g);
+bool sim_generate(Sim *s, unsigned int nr_threads);
+bool sim_seed(Sim *s);
+bool sim_simulate(Sim *s);
+void sim_record(Sim *s, size_t day);
+bool sim_schedule(Sim *s, size_t n, EventType type, unsigned long ts, unsigned int cause);
+
+void process_trans_SIR(Sim *s, PQEvent *ev);
+void process_rec_SIR(Sim *s, PQEvent *ev);
+
+size_t toss_coin(RngStream *st, size_t ts, double bias, size_t horizon);
+
+#endif
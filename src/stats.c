@@ -0,0 +1,130 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+#include "log.h"
+
+struct vector_stats vector_stats;
+
+struct phase_time {
+	double wall;
+	double cpu;
+};
+
+static struct {
+	/* of every context, gathered at the end */
+	struct sim_stats sim;
+	struct phase_time phase[_PHASE_MAX];
+	enum stats_phase cur;
+	struct timespec wall;
+	struct timespec cpu;
+} stats = { .cur = PHASE_IDLE };
+
+static const char *phase_name[_PHASE_MAX] = {
+	[PHASE_ALLOC] = "alloc",
+	[PHASE_GRAPH] = "graph",
+	[PHASE_SEED] = "seed",
+	[PHASE_SIMULATE] = "simulate",
+	[PHASE_REPORT] = "report",
+};
+
+#if STATS
+static double elapsed(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) * 1e-9;
+}
+#endif
+
+/* Charge the time since the last switch to the phase being left. CPU
+ * time is that of the whole process, so it counts every thread.
+ */
+void stats_phase(enum stats_phase p)
+{
+#if STATS
+	struct timespec wall, cpu;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	if (stats.cur != PHASE_IDLE) {
+		stats.phase[stats.cur].wall += elapsed(&stats.wall, &wall);
+		stats.phase[stats.cur].cpu += elapsed(&stats.cpu, &cpu);
+	}
+	stats.cur = p;
+	stats.wall = wall;
+	stats.cpu = cpu;
+#else
+	(void) p;
+#endif
+}
+
+void stats_merge(struct sim_stats *dst, const struct sim_stats *src)
+{
+	dst->runs += src->runs;
+	for (int t = 0; t < STATS_NR_TYPES; t++) {
+		dst->scheduled[t] += src->scheduled[t];
+		dst->processed[t] += src->processed[t];
+		dst->skipped[t] += src->skipped[t];
+		dst->superseded[t] += src->superseded[t];
+	}
+	if (src->queue_peak > dst->queue_peak)
+		dst->queue_peak = src->queue_peak;
+	dst->queue_sum += src->queue_sum;
+	dst->queue_samples += src->queue_samples;
+	dst->pool_alloc += src->pool_alloc;
+	dst->pool_release += src->pool_release;
+	if (src->pool_peak > dst->pool_peak)
+		dst->pool_peak = src->pool_peak;
+	dst->pool_slabs += src->pool_slabs;
+}
+
+/* add the counters of a context to the report */
+void stats_collect(const struct sim_stats *st)
+{
+	stats_merge(&stats.sim, st);
+}
+
+static void report_type(FILE *f, const char *name, int t, const char *sep)
+{
+	const struct sim_stats *st = &stats.sim;
+	fprintf(f, "    \"%s\": { \"scheduled\": %zu, \"superseded\": %zu, \"processed\": %zu, \"skipped\": %zu }%s\n",
+		name, st->scheduled[t], st->superseded[t], st->processed[t], st->skipped[t], sep);
+}
+
+/* everything counted so far as JSON, to path or - for stdout */
+bool stats_report(const char *path)
+{
+	const struct sim_stats *st = &stats.sim;
+	FILE *f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	if (!f) {
+		log_error("Failed to open stats report %s.", path);
+		return false;
+	}
+	if (!STATS)
+		log_warn("Built with STATS=0, nothing was counted.");
+	stats_phase(PHASE_IDLE);
+	fprintf(f, "{\n  \"enabled\": %s,\n  \"runs\": %zu,\n", STATS ? "true" : "false", st->runs);
+	fprintf(f, "  \"events\": {\n");
+	/* the values of EventType */
+	report_type(f, "transmit", 1, ",");
+	report_type(f, "recover", 2, "");
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"queue\": { \"peak\": %zu, \"mean\": %.3f },\n", st->queue_peak,
+		st->queue_samples ? (double) st->queue_sum / st->queue_samples : 0.0);
+	fprintf(f, "  \"pool\": { \"slabs\": %zu, \"allocated\": %zu, \"released\": %zu, \"peak\": %zu },\n",
+		st->pool_slabs, st->pool_alloc, st->pool_release, st->pool_peak);
+	fprintf(f, "  \"vector\": { \"grow\": %zu, \"shrink\": %zu, \"bytes\": %zu },\n",
+		atomic_load(&vector_stats.grow), atomic_load(&vector_stats.shrink),
+		atomic_load(&vector_stats.bytes));
+	fprintf(f, "  \"phases\": {\n");
+	for (int p = 0; p < _PHASE_MAX; p++)
+		fprintf(f, "    \"%s\": { \"wall\": %.6f, \"cpu\": %.6f }%s\n", phase_name[p],
+			stats.phase[p].wall, stats.phase[p].cpu, p + 1 < _PHASE_MAX ? "," : "");
+	fprintf(f, "  }\n}\n");
+	bool ok = !ferror(f);
+	if (f != stdout ? fclose(f) : fflush(f))
+		ok = false;
+	if (!ok)
+		log_error("Failed to write stats report %s.", path);
+	return ok;
+}
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Counters cost an increment on a context the thread owns already, and
+ * with -DSTATS=0 they are compiled out along with the phase timers.
+ */
+#ifndef STATS
+#define STATS 1
+#endif
+
+enum stats_phase {
+	PHASE_ALLOC,
+	PHASE_GRAPH,
+	PHASE_SEED,
+	PHASE_SIMULATE,
+	PHASE_REPORT,
+	_PHASE_MAX,
+	/* not timing anything */
+	PHASE_IDLE = _PHASE_MAX,
+};
+
+/* indexed by EventType, slot 0 unused */
+#define STATS_NR_TYPES 3
+
+/* what the runs of one simulation context did, summed over them */
+struct sim_stats {
+	size_t runs;
+	size_t scheduled[STATS_NR_TYPES];
+	size_t processed[STATS_NR_TYPES];
+	size_t skipped[STATS_NR_TYPES];
+	/* scheduled for a node with one queued already, of which only
+	   the earlier is kept */
+	size_t superseded[STATS_NR_TYPES];
+	/* queue length at each event taken off it, summed for the mean */
+	size_t queue_peak;
+	uint64_t queue_sum;
+	size_t queue_samples;
+	/* event pool, totals over the runs and the highest peak */
+	size_t pool_alloc;
+	size_t pool_release;
+	size_t pool_peak;
+	/* slabs of the queue, which it keeps across runs */
+	size_t pool_slabs;
+};
+
+/* shared by every thread, only touched when a buffer is resized */
+struct vector_stats {
+	atomic_size_t grow;
+	atomic_size_t shrink;
+	atomic_size_t bytes;
+};
+
+extern struct vector_stats vector_stats;
+
+#if STATS
+#define stats_inc(x) ((x)++)
+#define stats_add(x, n) ((x) += (n))
+#define stats_max(x, v) do { if ((v) > (x)) (x) = (v); } while (0)
+#define stats_atomic_add(x, n) atomic_fetch_add_explicit(&(x), (n), memory_order_relaxed)
+#else
+#define stats_inc(x) do {} while (0)
+#define stats_add(x, n) do {} while (0)
+#define stats_max(x, v) do {} while (0)
+#define stats_atomic_add(x, n) do {} while (0)
+#endif
+
+void stats_phase(enum stats_phase p);
+void stats_merge(struct sim_stats *dst, const struct sim_stats *src);
+void stats_collect(const struct sim_stats *st);
+bool stats_report(const char *path);
+
+#endif
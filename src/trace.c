@@ -0,0 +1,80 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prioq.h"
+#include "trace.h"
+#include "log.h"
+
+_Static_assert((int) TRACE_TRANSMIT == TRANSMIT && (int) TRACE_RECOVER == RECOVER,
+	       "trace record types are event types");
+
+static bool write_all(int fd, const void *p, size_t n)
+{
+	while (n) {
+		ssize_t r = write(fd, p, n);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p = (const char *) p + r;
+		n -= r;
+	}
+	return true;
+}
+
+bool trace_open(Trace *t, const char *path)
+{
+	struct trace_header h = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+	};
+
+	*t = (Trace) { .fd = -1 };
+	t->buf = malloc(TRACE_BUF_NR * sizeof *t->buf);
+	if (!t->buf) {
+		log_oom();
+		return false;
+	}
+	t->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (t->fd < 0 || !write_all(t->fd, &h, sizeof h)) {
+		log_error("Failed to open trace %s: %s", path, strerror(errno));
+		trace_close(t);
+		return false;
+	}
+	return true;
+}
+
+void trace_flush(Trace *t)
+{
+	if (!t->failed && t->len && !write_all(t->fd, t->buf, t->len * sizeof *t->buf)) {
+		log_error("Failed to write trace: %s, tracing stopped.", strerror(errno));
+		t->failed = true;
+	}
+	t->len = 0;
+}
+
+bool trace_close(Trace *t)
+{
+	bool ret;
+	if (t->fd >= 0)
+		trace_flush(t);
+	ret = !t->failed;
+	if (t->fd >= 0 && close(t->fd) < 0) {
+		log_error("Failed to close trace: %s", strerror(errno));
+		ret = false;
+	}
+	free(t->buf);
+	*t = (Trace) { .fd = -1 };
+	return ret;
+}
+
+void trace_begin(Trace *t, size_t scenario, size_t sample_size, unsigned long time_max)
+{
+	trace_event(t, time_max, TRACE_RUN, sample_size, scenario, TRACE_SCHEDULED);
+}
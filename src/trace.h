@@ -0,0 +1,89 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The binary event trace is a header followed by fixed size records in
+ * host byte order. Each run starts with a TRACE_RUN record, then has a
+ * record for every event scheduled, superseded, processed or skipped,
+ * in the order it happened. It is written by the simulation and read by
+ * tools/sir-trace.c, which includes this file alone.
+ */
+#define TRACE_MAGIC   "SIRT"
+#define TRACE_VERSION 2U
+/* records buffered before each write(2) */
+#define TRACE_BUF_NR  (1U << 16)
+
+/* record types, TRACE_TRANSMIT and TRACE_RECOVER are EventType */
+enum trace_type {
+	TRACE_RUN,
+	TRACE_TRANSMIT,
+	TRACE_RECOVER,
+};
+
+enum trace_action {
+	TRACE_SCHEDULED,
+	TRACE_PROCESSED,
+	/* out of the queue, but the node was past the state it acts on */
+	TRACE_SKIPPED,
+	/* taken out of the queue for an earlier event of the type on the
+	   node; its old day and cause are recorded. Later events the node
+	   never queues are only counted in the stats */
+	TRACE_SUPERSEDED,
+	_TRACE_ACTION_MAX,
+};
+
+struct trace_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t reserved;
+};
+
+/* for TRACE_RUN, timestamp is time_max, node the sample size and cause
+   the index of the scenario */
+struct trace_record {
+	uint32_t timestamp;
+	/* 1-based node ids, cause is 0 if none */
+	uint32_t node;
+	uint32_t cause;
+	uint8_t type;
+	uint8_t action;
+	uint16_t reserved;
+};
+
+_Static_assert(sizeof(struct trace_record) == 16, "trace record has padding");
+
+struct trace {
+	int fd;
+	/* stop tracing after a failed write */
+	bool failed;
+	size_t len;
+	struct trace_record *buf;
+};
+
+typedef struct trace Trace;
+
+bool trace_open(Trace *t, const char *path);
+bool trace_close(Trace *t);
+void trace_flush(Trace *t);
+void trace_begin(Trace *t, size_t scenario, size_t sample_size, unsigned long time_max);
+
+static inline void trace_event(Trace *t, unsigned long ts, unsigned int type,
+			       unsigned int node, unsigned int cause, enum trace_action action)
+{
+	if (t->failed) return;
+	t->buf[t->len++] = (struct trace_record) {
+		.timestamp = ts < UINT32_MAX ? ts : UINT32_MAX,
+		.node = node,
+		.cause = cause,
+		.type = type,
+		.action = action,
+	};
+	if (t->len == TRACE_BUF_NR)
+		trace_flush(t);
+}
+
+#endif
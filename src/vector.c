@@ -5,40 +5,136 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "stats.h"
 #include "vector.h"
 
-int vector_grow_many(Vector *v, size_t n)
+/* double when full, halve once three quarters are unused */
+static const struct vector_policy default_policy = {
+	.grow = 200,
+	.shrink_below = 25,
+};
+
+/* a buffer of size bytes holding the first used bytes of p, or NULL
+   with p left as it was */
+static unsigned char* vector_buf_realloc(unsigned char *p, size_t used,
+					 size_t size, size_t align, bool grow)
 {
-	/* check for maximum number of pools */
-	if (v->nr_pool + n > MAX_SZ/v->pool) return -ENOMEM;
-	void *p = malloc((v->nr_pool + n) * v->pool);
-	if (!p) return -errno;
-	memcpy(p, v->p, v->unit * v->length);
-	free(v->p);
-	v->p = p;
-	v->nr_pool += n;
+	unsigned char *b;
+	if (align) {
+		/* realloc does not preserve alignment, and aligned_alloc
+		   wants a multiple of it */
+		size = (size + align - 1) & ~(align - 1);
+		b = aligned_alloc(align, size);
+		if (!b) return NULL;
+		if (p) memcpy(b, p, used);
+		free(p);
+	} else {
+		b = realloc(p, size);
+		if (!b) return NULL;
+	}
+	if (grow)
+		stats_atomic_add(vector_stats.grow, 1);
+	else
+		stats_atomic_add(vector_stats.shrink, 1);
+	stats_atomic_add(vector_stats.bytes, size);
+	return b;
+}
+
+/* resize the buffer to hold exactly cap elements */
+static int vector_realloc(Vector *v, size_t cap)
+{
+	if (cap > MAX_SZ/v->unit) return -ENOMEM;
+	unsigned char *b = vector_buf_realloc(v->p, v->unit * v->length, cap * v->unit,
+					      v->align, cap > v->capacity);
+	if (!b) return -errno;
+	v->p = b;
+	v->capacity = cap;
 	return 0;
 }
 
-int vector_shrink_to_fit(Vector *v)
+/* capacity after growing from cap, but at least n */
+static size_t policy_next_cap(const struct vector_policy *policy, size_t cap, size_t n)
+{
+	size_t next = cap > MAX_SZ/policy->grow ? MAX_SZ : cap * policy->grow / 100;
+	if (next <= cap) next = cap + 1;
+	if (next < policy->min_cap) next = policy->min_cap;
+	return next < n ? n : next;
+}
+
+static size_t vector_next_cap(Vector *v, size_t cap, size_t n)
 {
-	// empty vector
-	if (!v->pool) return 0;
-	size_t used = v->unit * v->length;
-	if (used % v->pool) return 0;
-	/* stored size is multiple of pool size, find if a pool is free */
-	ssize_t diff = v->nr_pool - used / v->pool;
-	assert(diff >= 0);
-	if (diff) {
-		unsigned char *b;
-		v->nr_pool -= diff;
-		b = reallocarray(v->p, v->nr_pool, v->pool);
-		if (!b) return -errno;
-		v->p = b;
-	} /* vector partially pins a pool, hence no shrinking can be done */
+	return policy_next_cap(&v->policy, cap, n);
+}
+
+/* Slow path of the vectors of VECTOR_DEFINE(), with the default policy
+ * and a page worth of elements at least: room for n elements when n
+ * is above the capacity, else cut down to n and the headroom of one
+ * growth. Returns the new buffer, or NULL when p is left as it was.
+ */
+void* vector_buf_resize(void *p, size_t *capacity, size_t *shrink_at, size_t length,
+			size_t unit, size_t align, size_t n)
+{
+	struct vector_policy policy = default_policy;
+	policy.min_cap = unit < 4096 ? 4096 / unit : 1;
+	size_t cap;
+	if (n > *capacity) {
+		cap = policy_next_cap(&policy, *capacity, n);
+		if (cap > MAX_SZ/unit) return NULL;
+	} else {
+		cap = policy_next_cap(&policy, n, n);
+		if (cap >= *capacity) {
+			*shrink_at = 0;
+			return NULL;
+		}
+	}
+	unsigned char *b = vector_buf_realloc(p, unit * length, cap * unit, align,
+					      cap > *capacity);
+	if (!b) return NULL;
+	*capacity = cap;
+	/* at the least capacity, there is nothing to cut */
+	*shrink_at = cap > policy.min_cap ?
+		(cap * policy.shrink_below + 99) / 100 : 0;
+	return b;
+}
+
+int vector_set_policy(Vector *v, const struct vector_policy *policy)
+{
+	assert(v);
+	assert(policy);
+	if (policy->grow <= 100) return -EINVAL;
+	/* a shrunk buffer gets the headroom of one growth step; unless
+	   that lands back above the threshold, the next pop would shrink
+	   again and the hysteresis is lost */
+	if (policy->shrink_below * (size_t) policy->grow >= 100 * 100) return -EINVAL;
+	v->policy = *policy;
+	if (v->capacity < policy->min_cap)
+		return vector_realloc(v, policy->min_cap);
 	return 0;
 }
 
+int vector_reserve(Vector *v, size_t n)
+{
+	assert(v);
+	if (n <= v->capacity) return 0;
+	return vector_realloc(v, n);
+}
+
+int vector_grow(Vector *v)
+{
+	assert(v);
+	return vector_realloc(v, vector_next_cap(v, v->capacity, v->capacity + 1));
+}
+
+int vector_shrink_to_fit(Vector *v)
+{
+	assert(v);
+	size_t cap = v->length > v->policy.min_cap ? v->length : v->policy.min_cap;
+	/* keep one element around, so the buffer is never NULL */
+	if (!cap) cap = 1;
+	if (cap >= v->capacity) return 0;
+	return vector_realloc(v, cap);
+}
+
 int vector_insert(Vector *v, size_t pos, const void *p)
 {
 	return vector_insert_many(v, pos, p, 1);
@@ -54,8 +150,8 @@ int vector_insert_many(Vector *v, size_t pos, const void *p, size_t n)
 	/* check for max number of elements possible */
 	if (v->length + n > MAX_SZ/v->unit) return -ENOMEM;
 	if (pos > v->length) return -EINVAL;
-	if (v->nr_pool * v->pool < v->unit * (v->length + n)) {
-		int r = vector_grow_many(v, 1);
+	if (v->capacity < v->length + n) {
+		int r = vector_realloc(v, vector_next_cap(v, v->capacity, v->length + n));
 		if (r < 0) return r;
 	}
 	/* pointer to where we insert the element */
@@ -78,34 +174,55 @@ bool vector_pop_back(Vector *v)
 	assert(v);
 	if (!v->length) return false;
 	v->length--;
-	if (!v->length)	vector_reset(v);
+	/* the buffer is kept even when empty, see struct vector_policy
+	   for when it is cut down */
+	if (v->length * (size_t) 100 < v->capacity * (size_t) v->policy.shrink_below) {
+		size_t cap = vector_next_cap(v, v->length, v->length);
+		/* failing to shrink is harmless */
+		if (cap < v->capacity) vector_realloc(v, cap);
+	}
 	return true;
 }
 
 Vector* vector_new(size_t unit)
+{
+	return vector_new_aligned(unit, 0);
+}
+
+Vector* vector_new_aligned(size_t unit, size_t align)
 {
 	if (!unit) return NULL;
+	/* power of two */
+	if (align & (align - 1)) return NULL;
 	Vector *v = malloc(sizeof(*v));
 	if (!v)	return NULL;
 	v->length = 0;
 	v->unit = unit;
-	if (unit > 4096) v->pool = unit;
-	else v->pool = 4096;
-	v->p = malloc(v->pool);
-	if (!v->p) {
+	v->capacity = 0;
+	v->align = align;
+	v->policy = default_policy;
+	/* start with a page worth of elements */
+	v->policy.min_cap = unit < 4096 ? 4096 / unit : 1;
+	v->p = NULL;
+	if (vector_realloc(v, v->policy.min_cap) < 0) {
 		free(v);
 		return NULL;
 	}
-	v->nr_pool = 1;
 	return v;
 }
 
+/* drop all elements, but keep the buffer for reuse */
+void vector_clear(Vector *v)
+{
+	v->length = 0;
+}
+
 void vector_reset(Vector *v)
 {
 	v->length = 0;
 	v->unit = 0;
-	v->nr_pool = 0;
-	v->pool = 0;
+	v->capacity = 0;
+	v->align = 0;
 	free(v->p);
 	v->p = NULL;
 }
@@ -1,26 +1,49 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 
+#include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define MAX_SZ (SIZE_MAX >> 1)
 
+/* How the buffer follows the length. Capacity is multiplied by grow
+ * percent when full. When the length falls below shrink_below percent
+ * of the capacity, the buffer is cut down to leave the same headroom
+ * a growth would, so a length oscillating around a boundary does not
+ * reallocate on every call. Capacity never drops below min_cap.
+ */
+struct vector_policy {
+	/* growth factor in percent, > 100 */
+	unsigned int grow;
+	/* shrink threshold in percent of capacity, 0 never shrinks */
+	unsigned int shrink_below;
+	/* lower bound on capacity, in elements */
+	size_t min_cap;
+};
+
 struct vector {
 	/* number of elements */
 	size_t length;
 	/* base unit in bytes */
 	size_t unit;
-	/* number of pools */
-	size_t nr_pool;
-	/* pool size in bytes */
-	size_t pool;
+	/* number of elements the buffer can hold */
+	size_t capacity;
+	/* alignment of the buffer in bytes, 0 for malloc default */
+	size_t align;
+	struct vector_policy policy;
 	/* pointer to buffer */
 	unsigned char *p;
 };
 
 typedef struct vector Vector;
 
+int vector_set_policy(Vector *v, const struct vector_policy *policy);
+int vector_reserve(Vector *v, size_t n);
 int vector_grow(Vector *v);
 int vector_shrink_to_fit(Vector *v);
 int vector_insert(Vector *v, size_t pos, const void *p);
@@ -28,6 +51,85 @@ int vector_insert_many(Vector *v, size_t pos, const void *p, size_t n);
 int vector_push_back(Vector *v, const void *p);
 bool vector_pop_back(Vector *v);
 Vector* vector_new(size_t unit);
+Vector* vector_new_aligned(size_t unit, size_t align);
+void vector_clear(Vector *v);
 void vector_reset(Vector *v);
 
+void* vector_buf_resize(void *p, size_t *capacity, size_t *shrink_at, size_t length,
+			size_t unit, size_t align, size_t n);
+
+/* Vector of a given element type, e.g. VECTOR_DEFINE(PQEvent *, evvec)
+ * makes struct evvec and evvec_push(), evvec_pop() and the rest. Pushing
+ * and popping are inline and only call out to grow or cut down the
+ * buffer, which follows the default policy of the untyped vector. A
+ * zeroed struct is an empty vector, held by value by its owner, and the
+ * elements are read and written through p; only push, append, reserve
+ * and pop move it.
+ */
+#define VECTOR_DEFINE(type, name) VECTOR_DEFINE_ALIGNED(type, name, 0)
+
+#define VECTOR_DEFINE_ALIGNED(type, name, align)				\
+struct name {									\
+	type *p;								\
+	size_t length;								\
+	size_t capacity;							\
+	/* popping below this length cuts the buffer down */			\
+	size_t shrink_at;							\
+};										\
+										\
+static inline int name##_reserve(struct name *v, size_t n)			\
+{										\
+	if (n <= v->capacity) return 0;						\
+	void *p = vector_buf_resize(v->p, &v->capacity, &v->shrink_at,		\
+				    v->length, sizeof *v->p, (align), n);	\
+	if (!p) return -ENOMEM;							\
+	v->p = p;								\
+	return 0;								\
+}										\
+										\
+static inline int name##_push(struct name *v, type x)				\
+{										\
+	if (__builtin_expect(v->length == v->capacity, 0)) {			\
+		int r = name##_reserve(v, v->length + 1);			\
+		if (r < 0) return r;						\
+	}									\
+	v->p[v->length++] = x;							\
+	return 0;								\
+}										\
+										\
+static inline int name##_append(struct name *v, const type *x, size_t n)	\
+{										\
+	if (n > SIZE_MAX - v->length) return -EOVERFLOW;			\
+	int r = name##_reserve(v, v->length + n);				\
+	if (r < 0) return r;							\
+	if (n) memcpy(v->p + v->length, x, n * sizeof *x);			\
+	v->length += n;								\
+	return 0;								\
+}										\
+										\
+static inline type name##_pop(struct name *v)					\
+{										\
+	assert(v->length);							\
+	type x = v->p[--v->length];						\
+	if (__builtin_expect(v->length < v->shrink_at, 0)) {			\
+		/* failing to shrink is harmless */				\
+		void *p = vector_buf_resize(v->p, &v->capacity, &v->shrink_at,	\
+					    v->length, sizeof *v->p, (align),	\
+					    v->length);				\
+		if (p) v->p = p;						\
+	}									\
+	return x;								\
+}										\
+										\
+static inline void name##_clear(struct name *v)					\
+{										\
+	v->length = 0;								\
+}										\
+										\
+static inline void name##_release(struct name *v)				\
+{										\
+	free(v->p);								\
+	*v = (struct name) {};							\
+}
+
 #endif
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Branched scenarios against runs of their own.
+#
+#   tests/branch.sh ./covid-sim
+#
+# prob_y only acts when the seeds are queued, so two values of it give
+# different curves, and -B, which seeds once before the branch, must
+# refuse to branch on it rather than write the curve of the first twice.
+# prob_t variants branched at day 0 match the runs they stand for.
+
+sim=${1:-./covid-sim}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+fail=0
+
+check() {
+	if [ "$1" = 0 ]; then
+		echo "ok   $2"
+	else
+		echo "FAIL $2"
+		fail=1
+	fi
+}
+
+"$sim" -q -n 20000 -T 0.05 -Y 0.001 -o "$tmp/y1.csv" &&
+	"$sim" -q -n 20000 -T 0.05 -Y 0.2 -o "$tmp/y2.csv"
+check $? "runs with prob_y"
+! cmp -s "$tmp/y1.csv" "$tmp/y2.csv"
+check $? "two prob_y give different curves"
+
+"$sim" -q -n 20000 -T 0.05 -B 0 prob_y=0.001 prob_y=0.2 \
+	-o "$tmp/by.csv" 2>/dev/null
+[ $? -ne 0 ]
+check $? "-B refuses variants in prob_y"
+
+"$sim" -q -n 20000 -B 0 prob_t=0.05 prob_t=0.2 -o "$tmp/bt.csv" &&
+	"$sim" -q -n 20000 prob_t=0.05 prob_t=0.2 -o "$tmp/st.csv"
+check $? "runs with prob_t"
+cmp -s "$tmp/bt.csv" "$tmp/st.csv"
+check $? "prob_t branches match separate runs"
+
+exit $fail
@@ -0,0 +1,750 @@
+/* Benchmarks of the vector, the priority queue, alias tables, graph
+ * generation and whole simulations, written out as CSV to compare
+ * builds with.
+ *
+ *   cc -O2 -pthread -o sir-bench tools/sir-bench.c \
+ *      $(find src -name '*.c' ! -name main.c) -lm
+ *
+ * Every benchmark is warmed up and then sampled a number of times, each
+ * sample at least BENCH_MIN_NS of runs, and the fastest and the median
+ * sample are reported. The inputs are drawn from a fixed seed, so two
+ * builds are timed on the same work. With -b, the fastest samples,
+ * which vary the least from one invocation to the next, are compared
+ * against an earlier output and the exit status tells whether any got
+ * slower than allowed.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "../src/config.h"
+#include "../src/dist.h"
+#include "../src/graph.h"
+#include "../src/prioq.h"
+#include "../src/rng.h"
+#include "../src/sim.h"
+#include "../src/vector.h"
+#include "../src/log.h"
+
+char log_buf[LOG_BUF_SIZE];
+
+#define BENCH_SEED 0x5eedU
+/* mean degree of the graphs built here */
+#define BENCH_DEGREE 8
+/* elements per vector_insert_many() call */
+#define BENCH_BATCH 64
+#define BENCH_MAX_RESULTS 256
+/* least time measured for a sample */
+#define BENCH_MIN_NS 20000000U
+/* columns of the alias tables drawn from */
+#define BENCH_ALIAS_NR 16
+
+/* Allocations are counted by standing in for the allocator, which
+ * only glibc lets a program do by calling its own entry points. The
+ * sanitizers stand in for it themselves.
+ */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *p);
+
+static atomic_size_t nr_allocs, alloc_bytes;
+
+static inline void count_alloc(size_t size)
+{
+	atomic_fetch_add_explicit(&nr_allocs, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&alloc_bytes, size, memory_order_relaxed);
+}
+
+void *malloc(size_t size)
+{
+	count_alloc(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	count_alloc(n * size);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	count_alloc(size);
+	return __libc_realloc(p, size);
+}
+
+void *reallocarray(void *p, size_t n, size_t size)
+{
+	if (size && n > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc(p, n * size);
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	count_alloc(size);
+	return __libc_memalign(align, size);
+}
+
+int posix_memalign(void **p, size_t align, size_t size)
+{
+	count_alloc(size);
+	*p = __libc_memalign(align, size);
+	return *p ? 0 : ENOMEM;
+}
+
+void free(void *p)
+{
+	__libc_free(p);
+}
+
+#define allocs_read(n, b) (*(n) = atomic_load(&nr_allocs), *(b) = atomic_load(&alloc_bytes))
+
+#else
+
+#define allocs_read(n, b) (*(n) = 0, *(b) = 0)
+
+#endif
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+/* Peak RSS is kept per process, but Linux resets it on a write of 5
+ * to clear_refs, so each benchmark starts from the memory in use.
+ */
+static void rss_reset(void)
+{
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+	int fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (fd < 0) return;
+	/* without it, the peak is that of the whole process so far */
+	(void) !write(fd, "5", 1);
+	close(fd);
+}
+
+/* in kB, 0 when unknown */
+static size_t rss_peak(void)
+{
+	char line[256];
+	size_t kb = 0;
+	FILE *f = fopen("/proc/self/status", "r");
+	if (!f) return 0;
+	while (fgets(line, sizeof line, f))
+		if (sscanf(line, "VmHWM: %zu kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb;
+}
+
+/* everything a benchmark may set up before it is timed */
+VECTOR_DEFINE(uint64_t, u64_vec)
+
+struct bench_state {
+	size_t n;
+	Config cfg;
+	Rng rng;
+	Vector *vec;
+	struct u64_vec tvec;
+	PriorityQueue *pq;
+	PQEvent **evs;
+	unsigned long *delay;
+	unsigned int *pairs;
+	size_t nr_pairs;
+	GraphBuilder gb;
+	Graph graph;
+	/* a graph generated once per size, for the benchmarks that
+	   simulate on it */
+	Sim gen;
+	size_t gen_n;
+	Sim sim;
+	AliasTable alias;
+	double alias_w[BENCH_ALIAS_NR];
+	size_t alias_nr[BENCH_ALIAS_NR];
+};
+
+struct bench {
+	const char *name;
+	/* sizes swept, 0 terminated */
+	const size_t *sizes;
+	/* argument for the benchmark, the backend or the model */
+	int arg;
+	/* before every run, not timed */
+	bool (*setup)(struct bench_state *b, int arg);
+	/* timed, returns the number of operations done, 0 on failure */
+	size_t (*run)(struct bench_state *b, int arg);
+	/* after every run, not timed */
+	void (*teardown)(struct bench_state *b);
+};
+
+struct result {
+	char name[64];
+	size_t size;
+	/* fastest sample */
+	double ns_op;
+};
+
+static const size_t micro_sizes[] = { 1000, 10000, 100000, 1000000, 0 };
+static const size_t sim_sizes[] = { 10000, 100000, 1000000, 0 };
+
+static uint64_t draw(struct bench_state *b, uint64_t id, size_t bound)
+{
+	RngStream st;
+	rng_stream_init(&st, &b->rng, RNG_GRAPH, id, 0);
+	return rng_bounded(&st, bound);
+}
+
+static bool vec_setup(struct bench_state *b, int fill)
+{
+	b->vec = vector_new(sizeof(uint64_t));
+	if (!b->vec) return false;
+	for (uint64_t i = 0; fill && i < b->n; i++)
+		if (vector_push_back(b->vec, &i) < 0)
+			return false;
+	return true;
+}
+
+static void vec_teardown(struct bench_state *b)
+{
+	if (b->vec) {
+		vector_reset(b->vec);
+		free(b->vec);
+	}
+	b->vec = NULL;
+}
+
+static size_t vec_push_back(struct bench_state *b, int arg)
+{
+	(void) arg;
+	for (uint64_t i = 0; i < b->n; i++)
+		if (vector_push_back(b->vec, &i) < 0)
+			return 0;
+	return b->n;
+}
+
+static size_t vec_insert_many(struct bench_state *b, int arg)
+{
+	uint64_t batch[BENCH_BATCH] = {};
+	(void) arg;
+	for (size_t i = 0; i < b->n; i += BENCH_BATCH)
+		if (vector_insert_many(b->vec, b->vec->length, batch, BENCH_BATCH) < 0)
+			return 0;
+	return b->n;
+}
+
+static size_t vec_pop_back(struct bench_state *b, int arg)
+{
+	(void) arg;
+	while (vector_pop_back(b->vec))
+		;
+	return b->n;
+}
+
+/* the same on a vector of VECTOR_DEFINE() */
+static bool tvec_setup(struct bench_state *b, int fill)
+{
+	b->tvec = (struct u64_vec) {};
+	for (uint64_t i = 0; fill && i < b->n; i++)
+		if (u64_vec_push(&b->tvec, i) < 0)
+			return false;
+	return true;
+}
+
+static void tvec_teardown(struct bench_state *b)
+{
+	u64_vec_release(&b->tvec);
+}
+
+static size_t tvec_push(struct bench_state *b, int arg)
+{
+	(void) arg;
+	for (uint64_t i = 0; i < b->n; i++)
+		if (u64_vec_push(&b->tvec, i) < 0)
+			return 0;
+	return b->n;
+}
+
+static size_t tvec_pop(struct bench_state *b, int arg)
+{
+	(void) arg;
+	while (b->tvec.length)
+		u64_vec_pop(&b->tvec);
+	return b->n;
+}
+
+/* a queue with n events ready to add, queued as well when asked */
+static bool pq_setup_common(struct bench_state *b, int backend, bool queue)
+{
+	config_default(&b->cfg);
+	b->cfg.time_max = 1U << 16;
+	b->pq = pq_new(backend, &b->cfg);
+	b->evs = calloc(b->n, sizeof *b->evs);
+	b->delay = calloc(b->n, sizeof *b->delay);
+	if (!b->pq || !b->evs || !b->delay)
+		return false;
+	for (size_t i = 0; i < b->n; i++) {
+		if (!(b->evs[i] = pqevent_new(b->pq, 0, TRANSMIT)))
+			return false;
+		b->evs[i]->timestamp = draw(b, i, 1000);
+		b->delay[i] = 1 + draw(b, b->n + i, 32);
+		if (queue && !pqevent_add(b->pq, b->evs[i]))
+			return false;
+	}
+	return true;
+}
+
+static bool pq_setup(struct bench_state *b, int backend)
+{
+	return pq_setup_common(b, backend, false);
+}
+
+static bool pq_setup_full(struct bench_state *b, int backend)
+{
+	return pq_setup_common(b, backend, true);
+}
+
+static void pq_teardown(struct bench_state *b)
+{
+	pq_delete(b->pq);
+	free(b->evs);
+	free(b->delay);
+	b->pq = NULL;
+	b->evs = NULL;
+	b->delay = NULL;
+}
+
+static size_t pq_add(struct bench_state *b, int arg)
+{
+	(void) arg;
+	for (size_t i = 0; i < b->n; i++)
+		if (!pqevent_add(b->pq, b->evs[i]))
+			return 0;
+	return b->n;
+}
+
+static size_t pq_add_many(struct bench_state *b, int arg)
+{
+	(void) arg;
+	return pqevent_add_many(b->pq, b->evs, b->n) ? b->n : 0;
+}
+
+static size_t pq_drain(struct bench_state *b, int arg)
+{
+	PQEvent *ev;
+	(void) arg;
+	while ((ev = pqevent_next(b->pq)))
+		pqevent_delete(b->pq, ev);
+	return b->n;
+}
+
+/* every event moved to an earlier day, as an earlier infection does */
+static size_t pq_update(struct bench_state *b, int arg)
+{
+	(void) arg;
+	for (size_t i = 0; i < b->n; i++)
+		pqevent_update(b->pq, b->evs[i], b->evs[i]->timestamp / 2);
+	return b->n;
+}
+
+/* the classic hold model: take the earliest event and schedule a new
+   one a little later, at a steady queue length */
+static size_t pq_hold(struct bench_state *b, int arg)
+{
+	(void) arg;
+	for (size_t i = 0; i < b->n; i++) {
+		PQEvent *ev = pqevent_next(b->pq);
+		unsigned long ts = ev->timestamp;
+		pqevent_delete(b->pq, ev);
+		ev = pqevent_new(b->pq, 0, TRANSMIT);
+		if (!ev) return 0;
+		ev->timestamp = ts + b->delay[i];
+		if (!pqevent_add(b->pq, ev))
+			return 0;
+	}
+	return b->n;
+}
+
+/* random pairs, as many as the edges of a graph of BENCH_DEGREE */
+static bool graph_setup(struct bench_state *b, int fill)
+{
+	b->nr_pairs = b->n * BENCH_DEGREE / 2;
+	b->pairs = calloc(2 * b->nr_pairs, sizeof *b->pairs);
+	if (!b->pairs || !graph_builder_init(&b->gb, b->n))
+		return false;
+	for (size_t i = 0; i < 2 * b->nr_pairs; i++)
+		b->pairs[i] = draw(b, i, b->n);
+	for (size_t i = 0; fill && i < b->nr_pairs; i++)
+		if (graph_builder_connect(&b->gb, b->pairs[2 * i], b->pairs[2 * i + 1]) < 0)
+			return false;
+	return true;
+}
+
+static void graph_teardown(struct bench_state *b)
+{
+	graph_builder_release(&b->gb);
+	graph_release(&b->graph);
+	free(b->pairs);
+	b->pairs = NULL;
+}
+
+static size_t graph_connect(struct bench_state *b, int arg)
+{
+	(void) arg;
+	for (size_t i = 0; i < b->nr_pairs; i++)
+		if (graph_builder_connect(&b->gb, b->pairs[2 * i], b->pairs[2 * i + 1]) < 0)
+			return 0;
+	return b->nr_pairs;
+}
+
+static size_t graph_build_csr(struct bench_state *b, int arg)
+{
+	(void) arg;
+	return graph_build(&b->graph, b->n, b->gb.edges) ? b->gb.edges->length : 0;
+}
+
+static void sim_config(struct bench_state *b, int model)
+{
+	config_default(&b->cfg);
+	b->cfg.sample_size = b->n;
+	b->cfg.nr_edges = BENCH_DEGREE;
+	b->cfg.model = model;
+	b->cfg.seed = BENCH_SEED;
+}
+
+static bool gen_setup(struct bench_state *b, int model)
+{
+	sim_config(b, model);
+	return sim_init(&b->sim, &b->cfg) && sim_reset(&b->sim, &b->cfg);
+}
+
+static void sim_teardown(struct bench_state *b)
+{
+	sim_release(&b->sim);
+}
+
+static size_t gen_run(struct bench_state *b, int arg)
+{
+	(void) arg;
+	return sim_generate(&b->sim, 1) ? b->sim.gb.edges->length : 0;
+}
+
+/* a fresh context on the graph of this size, made only once */
+static bool sim_setup(struct bench_state *b, int arg)
+{
+	(void) arg;
+	sim_config(b, GRAPH_RANDOM);
+	if (b->gen_n != b->n) {
+		if (!sim_init(&b->gen, &b->cfg) || !sim_reset(&b->gen, &b->cfg) ||
+		    !sim_generate(&b->gen, 1))
+			return false;
+		b->gen_n = b->n;
+	}
+	if (!sim_init(&b->sim, &b->cfg) || !sim_reset(&b->sim, &b->cfg))
+		return false;
+	sim_share_graph(&b->sim, b->gen.g);
+	return true;
+}
+
+/* every node infected once, in turn */
+static size_t sim_trans(struct bench_state *b, int arg)
+{
+	Sim *s = &b->sim;
+	(void) arg;
+	for (size_t i = 0; i < b->n; i++) {
+		PQEvent *ev = pqevent_new(s->pq, i, TRANSMIT);
+		if (!ev) return 0;
+		ev->timestamp = 0;
+		process_trans_SIR(s, ev);
+		pqevent_delete(s->pq, ev);
+	}
+	return b->n;
+}
+
+/* a whole run, counting the events taken off the queue */
+static size_t sim_run(struct bench_state *b, int arg)
+{
+	Sim *s = &b->sim;
+	(void) arg;
+	if (!sim_seed(s))
+		return 0;
+	sim_simulate(s);
+	return s->pq->pool.nr_release;
+}
+
+/* Weights with zeroes among them, or all equal. The draws are checked
+ * against them as well as timed, a column off by more than six standard
+ * deviations, or drawn at all with a weight of zero, fails the run.
+ */
+static bool alias_setup(struct bench_state *b, int equal)
+{
+	for (size_t i = 0; i < BENCH_ALIAS_NR; i++) {
+		b->alias_w[i] = equal ? 1.0 : i % 4 == 1 ? 0.0 : (double) (i * i + 1);
+		b->alias_nr[i] = 0;
+	}
+	return alias_table_init(&b->alias, b->alias_w, BENCH_ALIAS_NR);
+}
+
+static void alias_teardown(struct bench_state *b)
+{
+	alias_table_release(&b->alias);
+}
+
+static size_t alias_draw(struct bench_state *b, int arg)
+{
+	RngStream st;
+	double sum = 0.0;
+	(void) arg;
+	rng_stream_init(&st, &b->rng, RNG_SEED, b->n, 0);
+	for (size_t i = 0; i < b->n; i++)
+		b->alias_nr[alias_table_sample(&b->alias, &st)]++;
+	for (size_t i = 0; i < BENCH_ALIAS_NR; i++)
+		sum += b->alias_w[i];
+	for (size_t i = 0; i < BENCH_ALIAS_NR; i++) {
+		double p = b->alias_w[i] / sum, mean = p * b->n;
+		double dev = fabs(b->alias_nr[i] - mean);
+		if (p == 0.0 ? b->alias_nr[i] != 0 : dev > 6.0 * sqrt(mean * (1.0 - p)) + 1.0) {
+			fprintf(stderr, "alias column %zu drawn %zu times in %zu, expected %.0f.\n",
+				i, b->alias_nr[i], b->n, mean);
+			return 0;
+		}
+	}
+	return b->n;
+}
+
+static const struct bench benches[] = {
+	{ "vector_push_back", micro_sizes, 0, vec_setup, vec_push_back, vec_teardown },
+	{ "vector_insert_many", micro_sizes, 0, vec_setup, vec_insert_many, vec_teardown },
+	{ "vector_pop_back", micro_sizes, 1, vec_setup, vec_pop_back, vec_teardown },
+	{ "typed_vector_push", micro_sizes, 0, tvec_setup, tvec_push, tvec_teardown },
+	{ "typed_vector_pop", micro_sizes, 1, tvec_setup, tvec_pop, tvec_teardown },
+	{ "pq_heap_add", micro_sizes, PQ_HEAP, pq_setup, pq_add, pq_teardown },
+	{ "pq_heap_add_many", micro_sizes, PQ_HEAP, pq_setup, pq_add_many, pq_teardown },
+	{ "pq_heap_drain", micro_sizes, PQ_HEAP, pq_setup_full, pq_drain, pq_teardown },
+	{ "pq_heap_hold", micro_sizes, PQ_HEAP, pq_setup_full, pq_hold, pq_teardown },
+	{ "pq_heap_update", micro_sizes, PQ_HEAP, pq_setup_full, pq_update, pq_teardown },
+	{ "pq_calendar_add", micro_sizes, PQ_CALENDAR, pq_setup, pq_add, pq_teardown },
+	{ "pq_calendar_drain", micro_sizes, PQ_CALENDAR, pq_setup_full, pq_drain, pq_teardown },
+	{ "pq_calendar_hold", micro_sizes, PQ_CALENDAR, pq_setup_full, pq_hold, pq_teardown },
+	{ "pq_calendar_update", micro_sizes, PQ_CALENDAR, pq_setup_full, pq_update, pq_teardown },
+	{ "alias_draw", micro_sizes, 0, alias_setup, alias_draw, alias_teardown },
+	{ "alias_draw_equal", micro_sizes, 1, alias_setup, alias_draw, alias_teardown },
+	{ "graph_connect", micro_sizes, 0, graph_setup, graph_connect, graph_teardown },
+	{ "graph_build", micro_sizes, 1, graph_setup, graph_build_csr, graph_teardown },
+	{ "gen_random", sim_sizes, GRAPH_RANDOM, gen_setup, gen_run, sim_teardown },
+	{ "gen_gnm", sim_sizes, GRAPH_GNM, gen_setup, gen_run, sim_teardown },
+	{ "gen_ba", sim_sizes, GRAPH_BA, gen_setup, gen_run, sim_teardown },
+	{ "gen_ws", sim_sizes, GRAPH_WS, gen_setup, gen_run, sim_teardown },
+	{ "process_trans_SIR", sim_sizes, 0, sim_setup, sim_trans, sim_teardown },
+	{ "sim_run", sim_sizes, 0, sim_setup, sim_run, sim_teardown },
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/* one sample: runs repeated until they add up to BENCH_MIN_NS, so
+   the small sizes are not lost in the resolution of the clock */
+static bool bench_sample(const struct bench *bh, struct bench_state *b, double *ns_op,
+			 size_t *ops, size_t *allocs, size_t *bytes)
+{
+	uint64_t total = 0;
+	size_t nr = 0, all = 0, a = 0, by = 0;
+
+	do {
+		size_t a0, b0, a1, b1, done = 0;
+		bool ok = bh->setup(b, bh->arg);
+		allocs_read(&a0, &b0);
+		uint64_t t0 = now_ns();
+		if (ok) done = bh->run(b, bh->arg);
+		uint64_t t1 = now_ns();
+		allocs_read(&a1, &b1);
+		bh->teardown(b);
+		if (!done) {
+			fprintf(stderr, "%s failed at size %zu.\n", bh->name, b->n);
+			return false;
+		}
+		total += t1 - t0;
+		all += done;
+		a += a1 - a0;
+		by += b1 - b0;
+		nr++;
+	} while (total < BENCH_MIN_NS);
+	*ns_op = (double) total / all;
+	*ops = all / nr;
+	*allocs = a / nr;
+	*bytes = by / nr;
+	return true;
+}
+
+/* warm up, then take reps samples; false if any run failed */
+static bool bench_one(const struct bench *bh, struct bench_state *b, size_t n,
+		      unsigned int reps, FILE *out, struct result *res)
+{
+	double ns[reps], warm;
+	size_t ops, allocs, bytes;
+
+	b->n = n;
+	rng_init(&b->rng, RNG_PHILOX, BENCH_SEED, 0);
+	/* a graph of another size would count towards the peak */
+	if (b->gen_n != n) {
+		sim_release(&b->gen);
+		b->gen_n = 0;
+	}
+	rss_reset();
+	if (!bench_sample(bh, b, &warm, &ops, &allocs, &bytes))
+		return false;
+	for (unsigned int r = 0; r < reps; r++)
+		if (!bench_sample(bh, b, ns + r, &ops, &allocs, &bytes))
+			return false;
+	qsort(ns, reps, sizeof *ns, cmp_double);
+	double median = reps % 2 ? ns[reps / 2] : (ns[reps / 2 - 1] + ns[reps / 2]) / 2;
+	fprintf(out, "%s,%zu,%u,%zu,%.3f,%.3f,%.0f,%zu,%zu,%zu\n", bh->name, n, reps, ops,
+		ns[0], median, 1e9 / median, rss_peak(), allocs, bytes);
+	fflush(out);
+	snprintf(res->name, sizeof res->name, "%s", bh->name);
+	res->size = n;
+	res->ns_op = ns[0];
+	return true;
+}
+
+/* results slower than those in the baseline by more than tol percent,
+   -1 if it cannot be read */
+static int compare(const char *path, const struct result *res, size_t nr, double tol)
+{
+	char line[512], name[64];
+	size_t size;
+	double ns_min;
+	int worse = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open baseline %s.\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof line, f)) {
+		if (sscanf(line, "%63[^,],%zu,%*u,%*u,%lf", name, &size, &ns_min) != 3)
+			continue;
+		for (size_t i = 0; i < nr; i++) {
+			if (strcmp(res[i].name, name) || res[i].size != size)
+				continue;
+			double change = 100.0 * (res[i].ns_op - ns_min) / ns_min;
+			if (change > tol) {
+				fprintf(stderr, "%s at %zu: %.3f ns/op against %.3f, %+.1f%%\n",
+					name, size, res[i].ns_op, ns_min, change);
+				worse++;
+			}
+		}
+	}
+	fclose(f);
+	return worse;
+}
+
+__attribute__((noreturn)) static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: sir-bench [-r reps] [-m max_size] [-f filter] [-c cpu]\n"
+		"                 [-o output] [-b baseline] [-t tolerance]\n"
+		"\n"
+		"Runs the benchmarks whose name contains filter, at sizes up to\n"
+		"max_size, pinned to cpu when given. Each takes reps samples (5\n"
+		"by default) of at least 20 ms after warming up. Writes a CSV\n"
+		"line per benchmark and size, with the operations per run, the\n"
+		"fastest and the median time per operation, the operations per\n"
+		"second at the median, the peak RSS, and the allocations per run\n"
+		"and their bytes. With -b, fails if the fastest time of any is\n"
+		"more than tolerance percent (10 by default) slower than in the\n"
+		"baseline, an earlier output of sir-bench.\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int reps = 5;
+	size_t max_size = SIZE_MAX;
+	const char *filter = NULL, *output = NULL, *baseline = NULL;
+	double tol = 10.0;
+	int cpu = -1, opt;
+
+	while ((opt = getopt(argc, argv, "r:m:f:c:o:b:t:h")) != -1) {
+		switch (opt) {
+		case 'r': reps = atoi(optarg); break;
+		case 'm': max_size = strtoull(optarg, NULL, 0); break;
+		case 'f': filter = optarg; break;
+		case 'c': cpu = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		case 'b': baseline = optarg; break;
+		case 't': tol = atof(optarg); break;
+		default: usage();
+		}
+	}
+	if (!reps || optind != argc)
+		usage();
+	if (cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof set, &set) < 0)
+			fprintf(stderr, "Failed to pin to CPU %d.\n", cpu);
+	}
+	FILE *out = output ? fopen(output, "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "Failed to open %s.\n", output);
+		return 1;
+	}
+	log_threshold = LOG_WARN;
+
+	static struct bench_state b;
+	static struct result res[BENCH_MAX_RESULTS];
+	size_t nr = 0;
+	int r = 0;
+	fprintf(out, "bench,size,reps,ops,ns_op_min,ns_op_median,ops_per_s,peak_rss_kb,allocs,alloc_bytes\n");
+	for (size_t i = 0; i < sizeof benches / sizeof *benches; i++) {
+		if (filter && !strstr(benches[i].name, filter))
+			continue;
+		for (const size_t *n = benches[i].sizes; *n && *n <= max_size; n++) {
+			if (nr == BENCH_MAX_RESULTS || !bench_one(benches + i, &b, *n, reps, out, res + nr)) {
+				r = 1;
+				goto out;
+			}
+			nr++;
+		}
+	}
+	if (baseline) {
+		int worse = compare(baseline, res, nr, tol);
+		if (worse)
+			r = 1;
+		if (worse > 0)
+			fprintf(stderr, "%d of %zu results slower than the baseline.\n", worse, nr);
+	}
+out:
+	sim_release(&b.gen);
+	if (out != stdout)
+		fclose(out);
+	return r;
+}
@@ -0,0 +1,221 @@
+/* Reads the binary event trace written by covid-sim -x.
+ *
+ *   cc -O2 -o sir-trace tools/sir-trace.c
+ *
+ * The trace is mapped rather than read, records are looked at in
+ * place.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/trace.h"
+
+enum { SUSCEPTIBLE, INFECTED, RECOVERED };
+
+static const char *type_name[] = {
+	[TRACE_RUN] = "RUN",
+	[TRACE_TRANSMIT] = "TRANSMIT",
+	[TRACE_RECOVER] = "RECOVER",
+};
+
+static const char *action_name[] = {
+	[TRACE_SCHEDULED] = "scheduled",
+	[TRACE_PROCESSED] = "processed",
+	[TRACE_SKIPPED] = "skipped",
+	[TRACE_SUPERSEDED] = "superseded",
+};
+
+/* a node number, as covid-sim counts them */
+static bool parse_node(const char *s, long *r)
+{
+	char *end;
+	errno = 0;
+	unsigned long u = strtoul(s, &end, 0);
+	if (errno || end == s || *end || *s == '-' || u > UINT32_MAX)
+		return false;
+	*r = u;
+	return true;
+}
+
+__attribute__((noreturn)) static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: sir-trace [-n node | -c] trace\n"
+		"\n"
+		"Without options, counts the events of each run. With -n, prints\n"
+		"the events of a node and those it caused. With -c, replays the\n"
+		"processed events and prints S, I, R and new infections at the\n"
+		"end of each day, as CSV in the format covid-sim writes.\n");
+	exit(1);
+}
+
+struct run {
+	const struct trace_record *rec;
+	size_t len;
+	uint32_t scenario;
+	uint32_t sample_size;
+	uint32_t time_max;
+};
+
+/* split off the run starting at *p, false when there is none left */
+static bool next_run(const struct trace_record **p, const struct trace_record *end, struct run *r)
+{
+	const struct trace_record *q = *p;
+	if (q == end) return false;
+	if (q->type != TRACE_RUN) {
+		fprintf(stderr, "Trace does not start with a run.\n");
+		return false;
+	}
+	*r = (struct run) { .rec = q + 1, .scenario = q->cause,
+			    .sample_size = q->node, .time_max = q->timestamp };
+	for (q++; q < end && q->type != TRACE_RUN; q++)
+		;
+	r->len = q - r->rec;
+	*p = q;
+	return true;
+}
+
+static void summary(const struct run *r)
+{
+	size_t nr[3][_TRACE_ACTION_MAX] = {};
+	for (size_t i = 0; i < r->len; i++)
+		if (r->rec[i].type <= TRACE_RECOVER && r->rec[i].action < _TRACE_ACTION_MAX)
+			nr[r->rec[i].type][r->rec[i].action]++;
+	printf("scenario %u: sample_size=%u time_max=%u events=%zu\n",
+	       r->scenario, r->sample_size, r->time_max, r->len);
+	for (int t = TRACE_TRANSMIT; t <= TRACE_RECOVER; t++)
+		printf("  %-8s scheduled=%zu superseded=%zu processed=%zu skipped=%zu\n",
+		       type_name[t], nr[t][TRACE_SCHEDULED], nr[t][TRACE_SUPERSEDED],
+		       nr[t][TRACE_PROCESSED], nr[t][TRACE_SKIPPED]);
+}
+
+static void filter(const struct run *r, uint32_t node)
+{
+	for (size_t i = 0; i < r->len; i++) {
+		const struct trace_record *e = r->rec + i;
+		if (e->node != node && e->cause != node)
+			continue;
+		if (e->type > TRACE_RECOVER || e->action >= _TRACE_ACTION_MAX)
+			continue;
+		printf("%u day=%u %s %s node=%u cause=%u\n", r->scenario, e->timestamp,
+		       type_name[e->type], action_name[e->action], e->node, e->cause);
+	}
+}
+
+/* the same transitions as the simulation makes */
+static bool curve(const struct run *r)
+{
+	uint8_t *state = calloc(r->sample_size + 1, 1);
+	size_t n[3] = { r->sample_size }, new_inf = 0;
+	uint32_t day = 0;
+
+	if (!state) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	for (size_t i = 0; i <= r->len; i++) {
+		const struct trace_record *e = r->rec + i;
+		/* past the last event every day is over */
+		uint32_t ts = i < r->len ? e->timestamp : r->time_max;
+		if (i < r->len && (e->action != TRACE_PROCESSED || e->node > r->sample_size))
+			continue;
+		for (; day < ts && day < r->time_max; day++) {
+			printf("%u,0,%u,%zu,%zu,%zu,%zu\n", r->scenario, day,
+			       n[SUSCEPTIBLE], n[INFECTED], n[RECOVERED], new_inf);
+			new_inf = 0;
+		}
+		if (i == r->len)
+			break;
+		uint8_t *s = state + e->node;
+		if (e->type == TRACE_TRANSMIT && *s == SUSCEPTIBLE) {
+			n[*s]--;
+			n[*s = INFECTED]++;
+			new_inf++;
+		} else if (e->type == TRACE_RECOVER && *s != RECOVERED) {
+			n[*s]--;
+			n[*s = RECOVERED]++;
+		}
+	}
+	free(state);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct trace_header *h;
+	const struct trace_record *p, *end;
+	struct run r;
+	struct stat st;
+	long node = -1;
+	bool do_curve = false;
+	int fd, opt, ret = 1;
+	void *map;
+
+	while ((opt = getopt(argc, argv, "n:ch")) != -1) {
+		switch (opt) {
+		case 'n':
+			if (!parse_node(optarg, &node)) {
+				fprintf(stderr, "-n takes a node number, not %s.\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c': do_curve = true; break;
+		default: usage();
+		}
+	}
+	if (optind + 1 != argc || (node >= 0 && do_curve))
+		usage();
+
+	fd = open(argv[optind], O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if ((size_t) st.st_size < sizeof *h) {
+		fprintf(stderr, "%s: too short for a trace.\n", argv[optind]);
+		close(fd);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	h = map;
+	if (memcmp(h->magic, TRACE_MAGIC, sizeof h->magic) || h->version != TRACE_VERSION ||
+	    h->record_size != sizeof *p) {
+		fprintf(stderr, "%s: not a version %u trace.\n", argv[optind], TRACE_VERSION);
+		goto out;
+	}
+	p = (const struct trace_record *) (h + 1);
+	/* a torn last record is left out */
+	end = p + (st.st_size - sizeof *h) / sizeof *p;
+
+	/* the runs follow each other in one table */
+	if (do_curve)
+		printf("scenario,replicate,day,S,I,R,new\n");
+	while (next_run(&p, end, &r)) {
+		if (do_curve) {
+			if (!curve(&r))
+				goto out;
+		} else if (node >= 0)
+			filter(&r, node);
+		else
+			summary(&r);
+	}
+	ret = p == end ? 0 : 1;
+out:
+	munmap(map, st.st_size);
+	return ret;
+}